@@ -0,0 +1,24 @@
+#include "actor.hpp"
+
+ActorSystem::ActorSystem(ThreadPool& pool, int throughput)
+    :pool_(pool)
+     ,throughput_(throughput > 0 ? throughput : 1)
+{}
+
+bool ActorSystem::trySchedule(function<void()> activation) {
+    return pool_.tryExecute(make_shared<FuncTask>(move(activation)));
+}
+
+int ActorSystem::getThroughput() const {
+    return throughput_;
+}
+
+void ActorSystem::schedule(function<void()> activation) {
+    /*
+    * 激活任务一旦丢失，Actor会一直停留在SCHEDULED状态，邮箱中的消息永远不会被处理
+    */
+    shared_ptr<FuncTask> task = make_shared<FuncTask>(move(activation));
+    if(!pool_.tryExecute(task)) {
+        task->exec();
+    }
+}
@@ -0,0 +1,238 @@
+#ifndef ACTOR_H
+#define ACTOR_H
+
+#include "threadpool.hpp"
+#include <atomic>
+#include <memory>
+#include <utility>
+
+/*
+* example:
+* class Counter : public Actor<int> {
+* public:
+*     Counter(ActorSystem& system) : Actor<int>(system) {}
+*     void receive(int& msg) { count += msg; }
+* private:
+*     int count = 0;
+* };
+*
+* ThreadPool pool;
+* pool.start(4);
+* ActorSystem system(pool);
+* shared_ptr<Counter> counter = make_shared<Counter>(system);
+* counter->tell(1);
+*/
+
+/*
+* ActorSystem负责把有消息的Actor调度到线程池上执行
+* throughput是每次激活最多处理的消息数，处理完后即使邮箱非空也要让出工作线程，保证Actor之间的公平性
+*/
+class ActorSystem {
+public:
+    ActorSystem(ThreadPool& pool, int throughput = 64);
+    ~ActorSystem() = default;
+
+    ActorSystem(const ActorSystem&) = delete;
+    ActorSystem& operator = (const ActorSystem&) = delete;
+
+    int getThroughput() const;
+
+    /*
+    * 投递一次Actor激活，队列已满时直接在当前线程执行，保证已经入队的消息一定会被处理
+    */
+    void schedule(function<void()> activation);
+
+    /*
+    * 投递一次Actor激活，队列已满时返回false，由调用者在当前线程继续处理
+    */
+    bool trySchedule(function<void()> activation);
+
+private:
+    ThreadPool& pool_;
+    int throughput_;
+};
+
+/*
+* 无锁多生产者单消费者邮箱（Vyukov intrusive MPSC队列）
+* 任意线程都可以push，只有正在激活Actor的工作线程pop，所以tail_不需要是原子变量
+* 哨兵节点内嵌在邮箱中，空闲的Actor除了几个指针之外不占用额外内存
+*/
+template<typename Msg>
+class Mailbox {
+public:
+    struct NodeBase {
+        atomic<NodeBase*> next{nullptr};
+    };
+
+    struct Node : public NodeBase {
+        Node(Msg m) : msg(move(m)) {}
+        Msg msg;
+    };
+
+    Mailbox() : head_(&stub_), tail_(&stub_) {}
+
+    ~Mailbox() {
+        while(Node* node = pop()) {
+            delete node;
+        }
+    }
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator = (const Mailbox&) = delete;
+
+    void push(Node* node) {
+        push(static_cast<NodeBase*>(node));
+    }
+
+    /*
+    * 返回nullptr表示邮箱为空，或者某个生产者已经交换了head_但还没来得及链接next
+    */
+    Node* pop() {
+        NodeBase* tail = tail_;
+        NodeBase* next = tail->next.load(memory_order_acquire);
+        if(tail == &stub_) {
+            if(next == nullptr) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(memory_order_acquire);
+        }
+        if(next != nullptr) {
+            tail_ = next;
+            return static_cast<Node*>(tail);
+        }
+        if(tail != head_.load(memory_order_acquire)) {
+            return nullptr;
+        }
+        push(&stub_);
+        next = tail->next.load(memory_order_acquire);
+        if(next != nullptr) {
+            tail_ = next;
+            return static_cast<Node*>(tail);
+        }
+        return nullptr;
+    }
+
+    /*
+    * 仅消费者调用，在放弃调度权之前记录tail_的状态
+    */
+    bool tailIsStub() const {
+        return tail_ == &stub_;
+    }
+
+    /*
+    * 任意线程都可以调用，tail_停在哨兵节点时，head_不是哨兵说明有新消息（或正在入队）
+    */
+    bool headIsStub() const {
+        return head_.load(memory_order_acquire) == &stub_;
+    }
+
+private:
+    void push(NodeBase* node) {
+        node->next.store(nullptr, memory_order_relaxed);
+        NodeBase* prev = head_.exchange(node, memory_order_acq_rel);
+        prev->next.store(node, memory_order_release);
+    }
+
+private:
+    atomic<NodeBase*> head_;
+    NodeBase* tail_;
+    NodeBase stub_;
+};
+
+/*
+* Actor基类，派生类重写receive处理消息
+* 同一个Actor的receive永远不会并发执行，因此派生类的状态不需要加锁
+* Actor必须由shared_ptr管理，激活期间线程池持有它的引用
+*/
+template<typename Msg>
+class Actor : public enable_shared_from_this<Actor<Msg>> {
+public:
+    Actor(ActorSystem& system) : system_(system), state_(IDLE) {}
+    virtual ~Actor() = default;
+
+    Actor(const Actor&) = delete;
+    Actor& operator = (const Actor&) = delete;
+
+    /*
+    * 发送消息，只有邮箱从空闲变为有消息的那一次发送才会向线程池投递任务
+    */
+    void tell(Msg msg) {
+        mailbox_.push(new typename Mailbox<Msg>::Node(move(msg)));
+        if(state_.exchange(SCHEDULED, memory_order_acq_rel) == IDLE) {
+            schedule();
+        }
+    }
+
+protected:
+    virtual void receive(Msg& msg) = 0;
+
+private:
+    enum : unsigned char {
+        IDLE,
+        SCHEDULED
+    };
+
+    void schedule() {
+        shared_ptr<Actor<Msg>> self = this->shared_from_this();
+        system_.schedule([self]() { self->activate(); });
+    }
+
+    bool trySchedule() {
+        shared_ptr<Actor<Msg>> self = this->shared_from_this();
+        return system_.trySchedule([self]() { self->activate(); });
+    }
+
+    /*
+    * 一次激活在同一个工作线程上连续处理多条消息，最多处理throughput条
+    * 需要重新调度但线程池队列已满时，在当前线程循环处理下一批，而不是通过schedule递归进入activate
+    */
+    void activate() {
+        for(;;) {
+            int budget = system_.getThroughput();
+            while(budget > 0) {
+                typename Mailbox<Msg>::Node* node = mailbox_.pop();
+                if(node == nullptr) {
+                    break;
+                }
+                receive(node->msg);
+                delete node;
+                budget--;
+            }
+
+            /*
+            * 预算耗尽，保持SCHEDULED状态重新排到队尾，让其他Actor有机会执行
+            */
+            if(budget == 0) {
+                if(trySchedule()) {
+                    return;
+                }
+                continue;
+            }
+
+            /*
+            * 放弃调度权后只能读取head_，tail_的状态必须提前记录，避免与下一次激活产生竞争
+            * 使用读-改-写放弃调度权：生产者的exchange排在它之前时，这里读到生产者写入的SCHEDULED，
+            * 与生产者先前对head_的交换同步，下面的检查一定能看到新消息
+            */
+            bool tailIsStub = mailbox_.tailIsStub();
+            state_.exchange(IDLE, memory_order_acq_rel);
+            if((!tailIsStub || !mailbox_.headIsStub())
+                && state_.exchange(SCHEDULED, memory_order_acq_rel) == IDLE) {
+                if(trySchedule()) {
+                    return;
+                }
+                continue;
+            }
+            return;
+        }
+    }
+
+private:
+    ActorSystem& system_;
+    Mailbox<Msg> mailbox_;
+    atomic<unsigned char> state_;
+};
+
+#endif
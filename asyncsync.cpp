@@ -0,0 +1,132 @@
+#include "asyncsync.hpp"
+
+/*
+* 所有await_suspend都在同一把锁内完成检查和登记，登记后释放锁就可能被其他线程恢复，之后不能再访问awaiter
+* 唤醒统一在释放锁之后进行
+*/
+
+bool AsyncLockAwaiter::await_suspend(coroutine_handle<> handle) {
+    unique_lock<mutex> lock(mutex_.stateMutex_);
+    if(!mutex_.locked_) {
+        mutex_.locked_ = true;
+        return false;
+    }
+    mutex_.waiters_.push_back(AsyncWaiter{handle, currentCoroutinePool()});
+    return true;
+}
+
+bool AsyncMutex::tryLock() {
+    unique_lock<mutex> lock(stateMutex_);
+    if(locked_) {
+        return false;
+    }
+    locked_ = true;
+    return true;
+}
+
+void AsyncMutex::unlock() {
+    AsyncWaiter next;
+    {
+        unique_lock<mutex> lock(stateMutex_);
+        if(waiters_.empty()) {
+            locked_ = false;
+            return;
+        }
+
+        /*
+        * 锁保持占用状态直接交给下一个协程，避免被新来的协程抢走导致等待者饿死
+        */
+        next = waiters_.front();
+        waiters_.pop_front();
+    }
+    next.resume();
+}
+
+bool AsyncAcquireAwaiter::await_suspend(coroutine_handle<> handle) {
+    unique_lock<mutex> lock(sem_.stateMutex_);
+    if(sem_.resource_ > 0) {
+        sem_.resource_--;
+        return false;
+    }
+    sem_.waiters_.push_back(AsyncWaiter{handle, currentCoroutinePool()});
+    return true;
+}
+
+bool AsyncSemaphore::tryAcquire() {
+    unique_lock<mutex> lock(stateMutex_);
+    if(resource_ <= 0) {
+        return false;
+    }
+    resource_--;
+    return true;
+}
+
+void AsyncSemaphore::release(int count) {
+    vector<AsyncWaiter> woken;
+    {
+        unique_lock<mutex> lock(stateMutex_);
+        while(count > 0 && !waiters_.empty()) {
+            woken.push_back(waiters_.front());
+            waiters_.pop_front();
+            count--;
+        }
+        resource_ += count;
+    }
+    for(AsyncWaiter& waiter : woken) {
+        waiter.resume();
+    }
+}
+
+bool AsyncLatchAwaiter::await_suspend(coroutine_handle<> handle) {
+    unique_lock<mutex> lock(latch_.stateMutex_);
+    if(latch_.count_ <= 0) {
+        return false;
+    }
+    latch_.waiters_.push_back(AsyncWaiter{handle, currentCoroutinePool()});
+    return true;
+}
+
+void AsyncLatch::countDown(int n) {
+    vector<AsyncWaiter> woken;
+    {
+        unique_lock<mutex> lock(stateMutex_);
+        if(count_ <= 0) {
+            return;
+        }
+        count_ -= n;
+        if(count_ > 0) {
+            return;
+        }
+        woken.swap(waiters_);
+    }
+    for(AsyncWaiter& waiter : woken) {
+        waiter.resume();
+    }
+}
+
+bool AsyncLatch::isReady() {
+    unique_lock<mutex> lock(stateMutex_);
+    return count_ <= 0;
+}
+
+bool AsyncBarrierAwaiter::await_suspend(coroutine_handle<> handle) {
+    vector<AsyncWaiter> woken;
+    {
+        unique_lock<mutex> lock(barrier_.stateMutex_);
+        barrier_.arrived_++;
+        if(barrier_.arrived_ < barrier_.count_) {
+            barrier_.waiters_.push_back(AsyncWaiter{handle, currentCoroutinePool()});
+            return true;
+        }
+
+        /*
+        * 最后一个到达，开始下一轮
+        */
+        barrier_.arrived_ = 0;
+        woken.swap(barrier_.waiters_);
+    }
+    for(AsyncWaiter& waiter : woken) {
+        waiter.resume();
+    }
+    return false;
+}
@@ -0,0 +1,186 @@
+#ifndef ASYNCSYNC_H
+#define ASYNCSYNC_H
+
+#include "coroutine.hpp"
+#include <deque>
+
+/*
+* 挂起在同步原语上的协程，唤醒时投递回它挂起前所在的线程池
+*/
+struct AsyncWaiter {
+    coroutine_handle<> handle;
+    ThreadPool* pool;
+
+    void resume() {
+        resumeOnPool(pool, handle);
+    }
+};
+
+class AsyncMutex;
+
+/*
+* co_await m.lock()的等待对象
+*/
+class AsyncLockAwaiter {
+public:
+    AsyncLockAwaiter(AsyncMutex& m) : mutex_(m) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    AsyncMutex& mutex_;
+};
+
+/*
+* example:
+* Coroutine update(AsyncMutex& m, Table& table) {
+*     co_await m.lock();
+*     table.update();
+*     m.unlock();
+* }
+*
+* 协程互斥锁：锁被占用时挂起协程而不是阻塞工作线程，
+* unlock时直接把锁交给等待队列中的第一个协程，并在线程池中恢复它（先来先服务）
+*/
+class AsyncMutex {
+public:
+    AsyncMutex() : locked_(false) {}
+
+    AsyncMutex(const AsyncMutex&) = delete;
+    AsyncMutex& operator = (const AsyncMutex&) = delete;
+
+    AsyncLockAwaiter lock() {
+        return AsyncLockAwaiter(*this);
+    }
+
+    bool tryLock();
+    void unlock();
+
+private:
+    friend class AsyncLockAwaiter;
+
+    bool locked_;
+    deque<AsyncWaiter> waiters_;
+    mutex stateMutex_;
+};
+
+class AsyncSemaphore;
+
+class AsyncAcquireAwaiter {
+public:
+    AsyncAcquireAwaiter(AsyncSemaphore& sem) : sem_(sem) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    AsyncSemaphore& sem_;
+};
+
+/*
+* 协程计数信号量：co_await sem.acquire()在没有资源时挂起协程，release把资源直接交给等待的协程
+*/
+class AsyncSemaphore {
+public:
+    AsyncSemaphore(int resource = 0) : resource_(resource) {}
+
+    AsyncSemaphore(const AsyncSemaphore&) = delete;
+    AsyncSemaphore& operator = (const AsyncSemaphore&) = delete;
+
+    AsyncAcquireAwaiter acquire() {
+        return AsyncAcquireAwaiter(*this);
+    }
+
+    bool tryAcquire();
+    void release(int count = 1);
+
+private:
+    friend class AsyncAcquireAwaiter;
+
+    int resource_;
+    deque<AsyncWaiter> waiters_;
+    mutex stateMutex_;
+};
+
+class AsyncLatch;
+
+class AsyncLatchAwaiter {
+public:
+    AsyncLatchAwaiter(AsyncLatch& latch) : latch_(latch) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    AsyncLatch& latch_;
+};
+
+/*
+* 协程门闩：计数减到0后，所有co_await latch.wait()的协程恢复执行，只能使用一次
+*/
+class AsyncLatch {
+public:
+    AsyncLatch(int count) : count_(count) {}
+
+    AsyncLatch(const AsyncLatch&) = delete;
+    AsyncLatch& operator = (const AsyncLatch&) = delete;
+
+    void countDown(int n = 1);
+
+    AsyncLatchAwaiter wait() {
+        return AsyncLatchAwaiter(*this);
+    }
+
+    bool isReady();
+
+private:
+    friend class AsyncLatchAwaiter;
+
+    int count_;
+    vector<AsyncWaiter> waiters_;
+    mutex stateMutex_;
+};
+
+class AsyncBarrier;
+
+class AsyncBarrierAwaiter {
+public:
+    AsyncBarrierAwaiter(AsyncBarrier& barrier) : barrier_(barrier) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    AsyncBarrier& barrier_;
+};
+
+/*
+* 协程屏障：每一轮有count个协程co_await barrier.arriveAndWait()后一起恢复，可以重复使用
+* 最后到达的协程不挂起，直接继续执行
+*/
+class AsyncBarrier {
+public:
+    AsyncBarrier(int count) : count_(count), arrived_(0) {}
+
+    AsyncBarrier(const AsyncBarrier&) = delete;
+    AsyncBarrier& operator = (const AsyncBarrier&) = delete;
+
+    AsyncBarrierAwaiter arriveAndWait() {
+        return AsyncBarrierAwaiter(*this);
+    }
+
+private:
+    friend class AsyncBarrierAwaiter;
+
+    int count_;
+    int arrived_;
+    vector<AsyncWaiter> waiters_;
+    mutex stateMutex_;
+};
+
+#endif
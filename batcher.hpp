@@ -0,0 +1,241 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include "cpuquota.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/*
+* 一个批次的共享状态，批次内所有元素的BatchFuture都指向它
+*/
+template<typename R>
+class BatchState {
+public:
+    BatchState() : done_(false) {}
+
+    void setResults(vector<R> results) {
+        unique_lock<mutex> lock(mutex_);
+        results_ = move(results);
+        done_ = true;
+        cond_.notify_all();
+    }
+
+    R take(size_t index) {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        cond_.wait(lock, [&]()->bool { return done_; });
+        return move(results_[index]);
+    }
+
+private:
+    vector<R> results_;
+    bool done_;
+    mutex mutex_;
+    condition_variable cond_;
+};
+
+/*
+* 单个元素的结果，get()等待所在批次执行完毕后取出该元素对应的结果，只能调用一次
+*/
+template<typename R>
+class BatchFuture {
+public:
+    BatchFuture(shared_ptr<BatchState<R>> state, size_t index)
+        : state_(move(state)), index_(index)
+    {}
+
+    R get() {
+        return state_->take(index_);
+    }
+
+private:
+    shared_ptr<BatchState<R>> state_;
+    size_t index_;
+};
+
+/*
+* example:
+* Batcher<Record, bool> batcher(pool, [](vector<Record>& records) {
+*     return writeAll(records);
+* }, 128, chrono::microseconds(500));
+* BatchFuture<bool> f = batcher.add(record);
+* bool ok = f.get();
+*
+* 微批处理：多个生产者线程提交的小元素先缓存在各自的分片中，
+* 分片中的元素达到maxBatch或者最早的元素等待超过linger时，整批作为一个任务提交给线程池，
+* 用有界的延迟换取吞吐量。handler返回的结果与输入元素一一对应。
+*/
+template<typename T, typename R>
+class Batcher {
+public:
+    using Handler = function<vector<R>(vector<T>&)>;
+
+    Batcher(ThreadPool& pool, Handler handler,
+            size_t maxBatch = 64,
+            chrono::microseconds linger = chrono::microseconds(1000),
+            size_t stripeCount = availableCpus())
+        : pool_(pool)
+        , handler_(move(handler))
+        , maxBatch_(maxBatch > 0 ? maxBatch : 1)
+        , linger_(linger)
+        , stripeCount_(stripeCount > 0 ? stripeCount : 1)
+        , stripes_(new Stripe[stripeCount_])
+        , inflight_(0)
+        , stopped_(false)
+    {
+        lingerThread_ = thread(&Batcher::lingerFunc, this);
+    }
+
+    /*
+    * 提交剩余的元素，并等待所有批次执行完毕，批次任务持有this
+    */
+    ~Batcher() {
+        {
+            unique_lock<mutex> lock(stateMutex_);
+            stopped_ = true;
+            stateCond_.notify_all();
+        }
+        lingerThread_.join();
+        flush();
+
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(stateMutex_);
+        stateCond_.wait(lock, [&]()->bool { return inflight_ == 0; });
+    }
+
+    Batcher(const Batcher&) = delete;
+    Batcher& operator = (const Batcher&) = delete;
+
+    /*
+    * 添加一个元素，返回该元素结果的future
+    */
+    BatchFuture<R> add(T item) {
+        Stripe& stripe = stripes_[stripeIndex() % stripeCount_];
+
+        unique_lock<mutex> lock(stripe.stripeMutex);
+        if(stripe.items.empty()) {
+            stripe.state = make_shared<BatchState<R>>();
+            stripe.firstTime = chrono::steady_clock::now();
+        }
+        stripe.items.emplace_back(move(item));
+        BatchFuture<R> future(stripe.state, stripe.items.size() - 1);
+
+        if(stripe.items.size() >= maxBatch_) {
+            dispatch(stripe, lock);
+        }
+        return future;
+    }
+
+    /*
+    * 立即提交所有分片中缓存的元素
+    */
+    void flush() {
+        for(size_t i = 0; i < stripeCount_; i++) {
+            unique_lock<mutex> lock(stripes_[i].stripeMutex);
+            if(!stripes_[i].items.empty()) {
+                dispatch(stripes_[i], lock);
+            }
+        }
+    }
+
+private:
+    /*
+    * 按缓存行对齐，避免不同线程的分片伪共享
+    */
+    struct alignas(64) Stripe {
+        mutex stripeMutex;
+        vector<T> items;
+        shared_ptr<BatchState<R>> state;
+        chrono::steady_clock::time_point firstTime;
+    };
+
+    /*
+    * 每个线程第一次提交时分配一个固定的分片序号，之后一直使用同一个分片
+    */
+    static size_t stripeIndex() {
+        static atomic<size_t> nextIndex{0};
+        thread_local size_t index = nextIndex.fetch_add(1, memory_order_relaxed);
+        return index;
+    }
+
+    /*
+    * 调用前需持有分片的锁，取走批次后释放锁再提交，handler不在锁内执行
+    */
+    void dispatch(Stripe& stripe, unique_lock<mutex>& lock) {
+        shared_ptr<vector<T>> items = make_shared<vector<T>>(move(stripe.items));
+        shared_ptr<BatchState<R>> state = move(stripe.state);
+        stripe.items.clear();
+        stripe.items.reserve(maxBatch_);
+        lock.unlock();
+
+        {
+            unique_lock<mutex> stateLock(stateMutex_);
+            inflight_++;
+        }
+
+        shared_ptr<FuncTask> task = make_shared<FuncTask>([this, items, state]() {
+            vector<R> results = handler_(*items);
+            results.resize(items->size());
+            state->setResults(move(results));
+
+            unique_lock<mutex> stateLock(stateMutex_);
+            inflight_--;
+            if(inflight_ == 0) {
+                stateCond_.notify_all();
+            }
+        });
+
+        /*
+        * 队列已满时不等待空位，直接在当前线程执行，保证每个future都能拿到结果
+        */
+        if(!pool_.tryExecute(task)) {
+            task->exec();
+        }
+    }
+
+    /*
+    * 后台线程每隔linger检查一次，提交等待时间超过linger的分片
+    */
+    void lingerFunc() {
+        for(;;) {
+            {
+                unique_lock<mutex> lock(stateMutex_);
+                if(stateCond_.wait_for(lock, linger_, [&]()->bool { return stopped_; })) {
+                    return;
+                }
+            }
+
+            auto now = chrono::steady_clock::now();
+            for(size_t i = 0; i < stripeCount_; i++) {
+                unique_lock<mutex> lock(stripes_[i].stripeMutex);
+                if(!stripes_[i].items.empty() && now - stripes_[i].firstTime >= linger_) {
+                    dispatch(stripes_[i], lock);
+                }
+            }
+        }
+    }
+
+private:
+    ThreadPool& pool_;
+    Handler handler_;
+    size_t maxBatch_;
+    chrono::microseconds linger_;
+
+    size_t stripeCount_;
+    unique_ptr<Stripe[]> stripes_;
+
+    /*
+    * 正在执行的批次数量，以及后台线程的停止标识
+    */
+    int inflight_;
+    bool stopped_;
+    mutex stateMutex_;
+    condition_variable stateCond_;
+
+    thread lingerThread_;
+};
+
+#endif
@@ -0,0 +1,201 @@
+/*
+* 同步原语微基准测试：对比primitives.hpp中的实现、原来基于mutex+condition_variable的Semaphore
+* 以及C++20标准库的std::counting_semaphore / std::latch / std::barrier
+*
+* 编译：
+* g++ -std=c++2a -O2 bench/bench_primitives.cpp -I. -o bench_primitives -pthread
+*/
+#include "primitives.hpp"
+#include <barrier>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <latch>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+* 原来的Semaphore实现，作为对比基准
+*/
+class MutexSemaphore {
+public:
+    MutexSemaphore(int resource = 0) : resource_(resource) {}
+
+    void wait() {
+        unique_lock<mutex> lock(semaphore_mutex);
+        cv.wait(lock, [&]()->bool { return resource_ > 0; });
+        resource_--;
+    }
+
+    void post() {
+        unique_lock<mutex> lock(semaphore_mutex);
+        resource_++;
+        cv.notify_all();
+    }
+private:
+    int resource_;
+    mutex semaphore_mutex;
+    condition_variable cv;
+};
+
+/*
+* 把std::counting_semaphore适配成wait/post接口
+*/
+class StdSemaphore {
+public:
+    StdSemaphore(int resource = 0) : sem_(resource) {}
+    void wait() { sem_.acquire(); }
+    void post() { sem_.release(); }
+private:
+    counting_semaphore<INT_MAX> sem_;
+};
+
+class StdLatch {
+public:
+    StdLatch(int count) : latch_(count) {}
+    void countDown() { latch_.count_down(); }
+    void wait() { latch_.wait(); }
+private:
+    latch latch_;
+};
+
+class StdBarrier {
+public:
+    StdBarrier(int count) : barrier_(count) {}
+    void arriveAndWait() { barrier_.arrive_and_wait(); }
+private:
+    barrier<> barrier_;
+};
+
+template<typename F>
+double measureNs(F func, long ops) {
+    auto start = chrono::steady_clock::now();
+    func();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / ops;
+}
+
+/*
+* 两个线程通过两个信号量来回传递，测量一次往返的延迟
+*/
+template<typename Sem>
+double pingPong(long rounds) {
+    Sem ping(0);
+    Sem pong(0);
+    return measureNs([&]() {
+        thread peer([&]() {
+            for(long i = 0; i < rounds; i++) {
+                ping.wait();
+                pong.post();
+            }
+        });
+        for(long i = 0; i < rounds; i++) {
+            ping.post();
+            pong.wait();
+        }
+        peer.join();
+    }, rounds);
+}
+
+/*
+* 多个生产者post、多个消费者wait，测量每个资源的平均开销
+*/
+template<typename Sem>
+double producerConsumer(int producers, int consumers, long total) {
+    Sem sem(0);
+    return measureNs([&]() {
+        vector<thread> threads;
+        for(int p = 0; p < producers; p++) {
+            threads.emplace_back([&]() {
+                for(long i = 0; i < total / producers; i++) {
+                    sem.post();
+                }
+            });
+        }
+        for(int c = 0; c < consumers; c++) {
+            threads.emplace_back([&]() {
+                for(long i = 0; i < total / consumers; i++) {
+                    sem.wait();
+                }
+            });
+        }
+        for(thread& t : threads) {
+            t.join();
+        }
+    }, total);
+}
+
+/*
+* 每轮创建一个门闩，workers个线程countDown，主线程wait
+*/
+template<typename L>
+double latchRounds(int workers, long rounds) {
+    return measureNs([&]() {
+        for(long r = 0; r < rounds; r++) {
+            L latch(workers);
+            vector<thread> threads;
+            for(int w = 0; w < workers; w++) {
+                threads.emplace_back([&]() { latch.countDown(); });
+            }
+            latch.wait();
+            for(thread& t : threads) {
+                t.join();
+            }
+        }
+    }, rounds);
+}
+
+/*
+* threads个线程反复通过同一个屏障，测量每一轮的耗时
+*/
+template<typename B>
+double barrierRounds(int parties, long rounds) {
+    B barrier(parties);
+    return measureNs([&]() {
+        vector<thread> threads;
+        for(int p = 0; p < parties; p++) {
+            threads.emplace_back([&]() {
+                for(long r = 0; r < rounds; r++) {
+                    barrier.arriveAndWait();
+                }
+            });
+        }
+        for(thread& t : threads) {
+            t.join();
+        }
+    }, rounds);
+}
+
+int main() {
+    const long rounds = 200000;
+    const long total = 2000000;
+    int cores = static_cast<int>(thread::hardware_concurrency());
+    int parties = cores > 1 ? (cores < 8 ? cores : 8) : 2;
+
+    printf("%-32s %14s %14s %14s\n", "benchmark (ns/op)", "mutex+cv", "futex", "std");
+
+    printf("%-32s %14.1f %14.1f %14.1f\n", "semaphore ping-pong",
+           pingPong<MutexSemaphore>(rounds),
+           pingPong<Semaphore>(rounds),
+           pingPong<StdSemaphore>(rounds));
+
+    printf("%-32s %14.1f %14.1f %14.1f\n", "semaphore 4 producers/4 consumers",
+           producerConsumer<MutexSemaphore>(4, 4, total),
+           producerConsumer<Semaphore>(4, 4, total),
+           producerConsumer<StdSemaphore>(4, 4, total));
+
+    printf("%-32s %14s %14.1f %14.1f\n", "latch 4 workers",
+           "-",
+           latchRounds<Latch>(4, 2000),
+           latchRounds<StdLatch>(4, 2000));
+
+    printf("%-32s %14s %14.1f %14.1f\n", "barrier",
+           "-",
+           barrierRounds<SpinBarrier>(parties, rounds / 10),
+           barrierRounds<StdBarrier>(parties, rounds / 10));
+    return 0;
+}
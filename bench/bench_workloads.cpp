@@ -0,0 +1,600 @@
+/*
+* 非规则并行负载基准测试，负载参考BOTS（Barcelona OpenMP Tasks Suite）：
+* 递归fib、n皇后、稀疏分块LU、分块矩阵乘法、各行开销不均的mandelbrot、突发请求模拟。
+* 每个负载只使用ThreadPool的公开接口（submitTask/Result、execute），先运行顺序版本作为基准并校验结果，
+* 然后在1、2、4...个线程下各运行一次，输出耗时、相对顺序版本的加速比和相对单线程的加速比。
+*
+* 编译：
+* g++ -std=c++2a -O2 bench/bench_workloads.cpp threadpool.cpp epoch.cpp spillfile.cpp cpubudget.cpp cpuquota.cpp -I. -o bench_workloads -pthread
+*
+* 运行：./bench_workloads [最大线程数]，默认为availableCpus()
+*/
+#include "threadpool.hpp"
+#include "cpuquota.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+template<typename F>
+double measureMs(F func) {
+    auto start = chrono::steady_clock::now();
+    func();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+/*
+* 等待一批通过execute提交的任务：提交前加一，任务结束时减一，减到0时唤醒
+*/
+class TaskGroup {
+public:
+    TaskGroup() : pending_(1) {}
+
+    void add() {
+        pending_.fetch_add(1, memory_order_relaxed);
+    }
+
+    void done() {
+        if(pending_.fetch_sub(1, memory_order_acq_rel) == 1) {
+            finished_.set();
+        }
+    }
+
+    /*
+    * 抵消构造时的1，等待所有任务结束
+    */
+    void wait() {
+        done();
+        finished_.wait();
+    }
+
+    /*
+    * 队列已满时在当前线程执行
+    */
+    void run(ThreadPool& pool, function<void()> func) {
+        add();
+        bool accepted = pool.execute([this, func]() {
+            func();
+            done();
+        });
+        if(!accepted) {
+            func();
+            done();
+        }
+    }
+
+private:
+    atomic<long> pending_;
+    Event finished_;
+};
+
+/*
+* 1. 递归fib：每个节点把fib(n-1)作为新任务提交，自己继续计算fib(n-2)，低于阈值时顺序计算
+* 任务之间不阻塞等待，叶子的结果累加到一个原子变量
+*/
+long fibSeq(int n) {
+    return n < 2 ? n : fibSeq(n - 1) + fibSeq(n - 2);
+}
+
+void fibTask(ThreadPool& pool, TaskGroup& group, atomic<long>& sum, int n, int cutoff) {
+    long local = 0;
+    while(n >= cutoff) {
+        int child = n - 1;
+        group.run(pool, [&pool, &group, &sum, child, cutoff]() {
+            fibTask(pool, group, sum, child, cutoff);
+        });
+        n -= 2;
+    }
+    local += fibSeq(n);
+    sum.fetch_add(local, memory_order_relaxed);
+}
+
+/*
+* 2. n皇后：前两行的每种合法摆放是一个Task，剩余部分在任务中顺序回溯
+*/
+int queensSeq(int n, int row, unsigned cols, unsigned diag1, unsigned diag2) {
+    if(row == n) {
+        return 1;
+    }
+    int count = 0;
+    unsigned available = ~(cols | diag1 | diag2) & ((1u << n) - 1);
+    while(available != 0) {
+        unsigned bit = available & (0u - available);
+        available ^= bit;
+        count += queensSeq(n, row + 1, cols | bit, (diag1 | bit) << 1, (diag2 | bit) >> 1);
+    }
+    return count;
+}
+
+class QueensTask : public Task {
+public:
+    QueensTask(int n, unsigned cols, unsigned diag1, unsigned diag2)
+        : n_(n), cols_(cols), diag1_(diag1), diag2_(diag2) {}
+
+    Any run() {
+        return queensSeq(n_, 2, cols_, diag1_, diag2_);
+    }
+private:
+    int n_;
+    unsigned cols_;
+    unsigned diag1_;
+    unsigned diag2_;
+};
+
+int queensParallel(ThreadPool& pool, int n) {
+    vector<unique_ptr<Result>> results;
+    for(int c0 = 0; c0 < n; c0++) {
+        unsigned b0 = 1u << c0;
+        for(int c1 = 0; c1 < n; c1++) {
+            unsigned b1 = 1u << c1;
+            if((b1 & (b0 | b0 << 1 | b0 >> 1)) != 0) {
+                continue;
+            }
+            unsigned cols = b0 | b1;
+            unsigned diag1 = ((b0 << 1) | b1) << 1;
+            unsigned diag2 = ((b0 >> 1) | b1) >> 1;
+            results.emplace_back(new Result(pool.submitTask(make_shared<QueensTask>(n, cols, diag1, diag2))));
+        }
+    }
+    int total = 0;
+    for(unique_ptr<Result>& res : results) {
+        total += res->get().cast_<int>();
+    }
+    return total;
+}
+
+/*
+* 3. 稀疏分块LU（BOTS sparselu）：矩阵由blocks x blocks个子块组成，部分子块为空
+* 每一步k：分解对角块lu0，然后并行执行同一行的fwd和同一列的bdiv，最后并行执行bmod更新剩余子矩阵，
+* bmod遇到空块时先分配。
+*/
+struct SparseMatrix {
+    int blocks;
+    int blockSize;
+    vector<vector<float>> data;
+
+    vector<float>* block(int i, int j) {
+        vector<float>& b = data[i * blocks + j];
+        return b.empty() ? nullptr : &b;
+    }
+};
+
+SparseMatrix makeSparse(int blocks, int blockSize) {
+    SparseMatrix m{blocks, blockSize, vector<vector<float>>(blocks * blocks)};
+    for(int i = 0; i < blocks; i++) {
+        for(int j = 0; j < blocks; j++) {
+            bool present = i == j || i == j - 1 || i == j + 1 || (i % 3 == 0 && j % 2 == 0)
+                || (j % 3 == 0 && i % 2 == 0);
+            if(!present) {
+                continue;
+            }
+            vector<float>& b = m.data[i * blocks + j];
+            b.resize(blockSize * blockSize);
+            unsigned seed = static_cast<unsigned>(i * 131 + j * 7 + 1);
+            for(int k = 0; k < blockSize * blockSize; k++) {
+                seed = seed * 1103515245u + 12345u;
+                b[k] = static_cast<float>((seed >> 16) & 0x7fff) / 32768.0f;
+            }
+            /*
+            * 对角占优，消元不需要选主元
+            */
+            if(i == j) {
+                for(int k = 0; k < blockSize; k++) {
+                    b[k * blockSize + k] += static_cast<float>(blocks * blockSize);
+                }
+            }
+        }
+    }
+    return m;
+}
+
+void lu0(float* diag, int bs) {
+    for(int k = 0; k < bs; k++) {
+        for(int i = k + 1; i < bs; i++) {
+            diag[i * bs + k] /= diag[k * bs + k];
+            for(int j = k + 1; j < bs; j++) {
+                diag[i * bs + j] -= diag[i * bs + k] * diag[k * bs + j];
+            }
+        }
+    }
+}
+
+void fwd(const float* diag, float* col, int bs) {
+    for(int k = 0; k < bs; k++) {
+        for(int i = k + 1; i < bs; i++) {
+            for(int j = 0; j < bs; j++) {
+                col[i * bs + j] -= diag[i * bs + k] * col[k * bs + j];
+            }
+        }
+    }
+}
+
+void bdiv(const float* diag, float* row, int bs) {
+    for(int i = 0; i < bs; i++) {
+        for(int k = 0; k < bs; k++) {
+            row[i * bs + k] /= diag[k * bs + k];
+            for(int j = k + 1; j < bs; j++) {
+                row[i * bs + j] -= row[i * bs + k] * diag[k * bs + j];
+            }
+        }
+    }
+}
+
+void bmod(const float* row, const float* col, float* inner, int bs) {
+    for(int i = 0; i < bs; i++) {
+        for(int k = 0; k < bs; k++) {
+            float r = row[i * bs + k];
+            for(int j = 0; j < bs; j++) {
+                inner[i * bs + j] -= r * col[k * bs + j];
+            }
+        }
+    }
+}
+
+/*
+* pool为空时顺序执行
+*/
+void sparseLu(SparseMatrix& m, ThreadPool* pool) {
+    int nb = m.blocks;
+    int bs = m.blockSize;
+
+    auto runAll = [&](vector<function<void()>>& jobs) {
+        if(pool == nullptr) {
+            for(function<void()>& job : jobs) {
+                job();
+            }
+        } else {
+            TaskGroup group;
+            for(function<void()>& job : jobs) {
+                group.run(*pool, job);
+            }
+            group.wait();
+        }
+        jobs.clear();
+    };
+
+    vector<function<void()>> jobs;
+    for(int k = 0; k < nb; k++) {
+        float* diag = m.block(k, k)->data();
+        lu0(diag, bs);
+
+        for(int j = k + 1; j < nb; j++) {
+            if(vector<float>* col = m.block(k, j)) {
+                jobs.emplace_back([diag, col, bs]() { fwd(diag, col->data(), bs); });
+            }
+        }
+        for(int i = k + 1; i < nb; i++) {
+            if(vector<float>* row = m.block(i, k)) {
+                jobs.emplace_back([diag, row, bs]() { bdiv(diag, row->data(), bs); });
+            }
+        }
+        runAll(jobs);
+
+        for(int i = k + 1; i < nb; i++) {
+            vector<float>* row = m.block(i, k);
+            if(row == nullptr) {
+                continue;
+            }
+            for(int j = k + 1; j < nb; j++) {
+                vector<float>* col = m.block(k, j);
+                if(col == nullptr) {
+                    continue;
+                }
+                /*
+                * 空块在提交前分配，任务之间不会同时修改data
+                */
+                vector<float>& inner = m.data[i * nb + j];
+                if(inner.empty()) {
+                    inner.assign(bs * bs, 0.0f);
+                }
+                float* target = inner.data();
+                jobs.emplace_back([row, col, target, bs]() { bmod(row->data(), col->data(), target, bs); });
+            }
+        }
+        runAll(jobs);
+    }
+}
+
+double checksum(const SparseMatrix& m) {
+    double sum = 0;
+    for(const vector<float>& b : m.data) {
+        for(float v : b) {
+            sum += v;
+        }
+    }
+    return sum;
+}
+
+/*
+* 4. 分块矩阵乘法：C的每个tile x tile子块是一个Task
+*/
+class MatmulTask : public Task {
+public:
+    MatmulTask(const vector<double>& a, const vector<double>& b, vector<double>& c,
+               int n, int tile, int bi, int bj)
+        : a_(a), b_(b), c_(c), n_(n), tile_(tile), bi_(bi), bj_(bj) {}
+
+    Any run() {
+        matmulBlock(a_, b_, c_, n_, tile_, bi_, bj_);
+        return 0;
+    }
+
+    static void matmulBlock(const vector<double>& a, const vector<double>& b, vector<double>& c,
+                            int n, int tile, int bi, int bj) {
+        int iEnd = min(bi + tile, n);
+        int jEnd = min(bj + tile, n);
+        for(int bk = 0; bk < n; bk += tile) {
+            int kEnd = min(bk + tile, n);
+            for(int i = bi; i < iEnd; i++) {
+                for(int k = bk; k < kEnd; k++) {
+                    double aik = a[i * n + k];
+                    for(int j = bj; j < jEnd; j++) {
+                        c[i * n + j] += aik * b[k * n + j];
+                    }
+                }
+            }
+        }
+    }
+private:
+    const vector<double>& a_;
+    const vector<double>& b_;
+    vector<double>& c_;
+    int n_;
+    int tile_;
+    int bi_;
+    int bj_;
+};
+
+/*
+* 5. mandelbrot：每一行是一个任务，靠近集合的行迭代次数多，各行开销相差几十倍
+*/
+int mandelbrotRow(vector<int>& image, int width, int height, int row, int maxIter) {
+    int total = 0;
+    double y = -1.2 + 2.4 * row / height;
+    for(int col = 0; col < width; col++) {
+        double x = -2.1 + 3.0 * col / width;
+        double zx = 0;
+        double zy = 0;
+        int iter = 0;
+        while(iter < maxIter && zx * zx + zy * zy < 4.0) {
+            double t = zx * zx - zy * zy + x;
+            zy = 2 * zx * zy + y;
+            zx = t;
+            iter++;
+        }
+        image[row * width + col] = iter;
+        total += iter;
+    }
+    return total;
+}
+
+/*
+* 6. 突发请求模拟：请求成批到达，批之间有空闲间隔，每个请求忙等5~50微秒
+* 记录每个请求从提交到开始执行的排队延迟，输出p99
+*/
+void busyWait(chrono::microseconds duration) {
+    auto end = chrono::steady_clock::now() + duration;
+    while(chrono::steady_clock::now() < end) {
+    }
+}
+
+struct BurstyConfig {
+    int bursts = 20;
+    int requestsPerBurst = 1000;
+    chrono::milliseconds gap = chrono::milliseconds(2);
+};
+
+vector<chrono::microseconds> burstyServiceTimes(const BurstyConfig& config) {
+    mt19937 rng(42);
+    uniform_int_distribution<int> dist(5, 50);
+    vector<chrono::microseconds> times(config.bursts * config.requestsPerBurst);
+    for(chrono::microseconds& t : times) {
+        t = chrono::microseconds(dist(rng));
+    }
+    return times;
+}
+
+double burstyP99Us;
+
+void burstyParallel(ThreadPool& pool, const BurstyConfig& config, const vector<chrono::microseconds>& service) {
+    vector<double> latency(service.size());
+    TaskGroup group;
+    size_t index = 0;
+    for(int b = 0; b < config.bursts; b++) {
+        for(int r = 0; r < config.requestsPerBurst; r++, index++) {
+            auto submitted = chrono::steady_clock::now();
+            size_t i = index;
+            group.run(pool, [&latency, &service, submitted, i]() {
+                latency[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - submitted).count();
+                busyWait(service[i]);
+            });
+        }
+        this_thread::sleep_for(config.gap);
+    }
+    group.wait();
+    sort(latency.begin(), latency.end());
+    burstyP99Us = latency[latency.size() * 99 / 100];
+}
+
+/*
+* 输出一个负载的加速比曲线
+*/
+void report(const char* name, double sequentialMs, const vector<int>& threadCounts,
+            const function<double(int)>& runParallel, bool showP99 = false) {
+    printf("%s\n", name);
+    printf("  %-10s %12.1f ms\n", "sequential", sequentialMs);
+    double singleMs = 0;
+    for(int threads : threadCounts) {
+        double ms = runParallel(threads);
+        if(threads == 1) {
+            singleMs = ms;
+        }
+        printf("  %3d thread%s %10.1f ms   speedup %5.2fx vs sequential   %5.2fx vs 1 thread",
+               threads, threads == 1 ? " " : "s", ms, sequentialMs / ms, singleMs > 0 ? singleMs / ms : 0.0);
+        if(showP99) {
+            printf("   p99 queueing %.0f us", burstyP99Us);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+void verify(bool ok, const char* name) {
+    if(!ok) {
+        fprintf(stderr, "%s: parallel result does not match the sequential baseline\n", name);
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : availableCpus();
+    maxThreads = max(maxThreads, 1);
+    vector<int> threadCounts;
+    for(int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    printf("threads: 1..%d\n\n", maxThreads);
+
+    /*
+    * 每次运行都新建线程池，启动后才开始计时
+    */
+    auto withPool = [](int threads, const function<void(ThreadPool&)>& body) {
+        ThreadPool pool;
+        pool.start(threads);
+        return measureMs([&]() { body(pool); });
+    };
+
+    {
+        const int n = 34;
+        const int cutoff = 22;
+        long expected = 0;
+        double seq = measureMs([&]() { expected = fibSeq(n); });
+        report("fib(34), cutoff 22", seq, threadCounts, [&](int threads) {
+            atomic<long> sum(0);
+            double ms = withPool(threads, [&](ThreadPool& pool) {
+                TaskGroup group;
+                fibTask(pool, group, sum, n, cutoff);
+                group.wait();
+            });
+            verify(sum.load() == expected, "fib");
+            return ms;
+        });
+    }
+
+    {
+        const int n = 12;
+        int expected = 0;
+        double seq = measureMs([&]() { expected = queensSeq(n, 0, 0, 0, 0); });
+        report("n-queens(12)", seq, threadCounts, [&](int threads) {
+            int count = 0;
+            double ms = withPool(threads, [&](ThreadPool& pool) { count = queensParallel(pool, n); });
+            verify(count == expected, "n-queens");
+            return ms;
+        });
+    }
+
+    {
+        const int blocks = 32;
+        const int blockSize = 32;
+        SparseMatrix reference = makeSparse(blocks, blockSize);
+        double seq = measureMs([&]() { sparseLu(reference, nullptr); });
+        double expected = checksum(reference);
+        report("sparse LU (32x32 blocks of 32x32)", seq, threadCounts, [&](int threads) {
+            SparseMatrix m = makeSparse(blocks, blockSize);
+            double ms = withPool(threads, [&](ThreadPool& pool) { sparseLu(m, &pool); });
+            verify(checksum(m) == expected, "sparse LU");
+            return ms;
+        });
+    }
+
+    {
+        const int n = 768;
+        const int tile = 64;
+        vector<double> a(n * n);
+        vector<double> b(n * n);
+        for(int i = 0; i < n * n; i++) {
+            a[i] = (i % 17) * 0.25;
+            b[i] = (i % 13) * 0.5;
+        }
+        vector<double> expected(n * n, 0.0);
+        double seq = measureMs([&]() {
+            for(int bi = 0; bi < n; bi += tile) {
+                for(int bj = 0; bj < n; bj += tile) {
+                    MatmulTask::matmulBlock(a, b, expected, n, tile, bi, bj);
+                }
+            }
+        });
+        report("blocked matmul (768, tile 64)", seq, threadCounts, [&](int threads) {
+            vector<double> c(n * n, 0.0);
+            double ms = withPool(threads, [&](ThreadPool& pool) {
+                vector<unique_ptr<Result>> results;
+                for(int bi = 0; bi < n; bi += tile) {
+                    for(int bj = 0; bj < n; bj += tile) {
+                        results.emplace_back(new Result(pool.submitTask(
+                            make_shared<MatmulTask>(a, b, c, n, tile, bi, bj))));
+                    }
+                }
+                for(unique_ptr<Result>& res : results) {
+                    res->get();
+                }
+            });
+            verify(c == expected, "matmul");
+            return ms;
+        });
+    }
+
+    {
+        const int width = 1024;
+        const int height = 768;
+        const int maxIter = 2000;
+        vector<int> expected(width * height);
+        double seq = measureMs([&]() {
+            for(int row = 0; row < height; row++) {
+                mandelbrotRow(expected, width, height, row, maxIter);
+            }
+        });
+        report("mandelbrot (1024x768, uneven rows)", seq, threadCounts, [&](int threads) {
+            vector<int> image(width * height);
+            double ms = withPool(threads, [&](ThreadPool& pool) {
+                TaskGroup group;
+                for(int row = 0; row < height; row++) {
+                    group.run(pool, [&image, row, width, height, maxIter]() { mandelbrotRow(image, width, height, row, maxIter); });
+                }
+                group.wait();
+            });
+            verify(image == expected, "mandelbrot");
+            return ms;
+        });
+    }
+
+    {
+        BurstyConfig config;
+        vector<chrono::microseconds> service = burstyServiceTimes(config);
+
+        /*
+        * 顺序基准：同样的到达节奏，请求在提交线程中逐个处理
+        */
+        double seq = measureMs([&]() {
+            size_t index = 0;
+            for(int b = 0; b < config.bursts; b++) {
+                for(int r = 0; r < config.requestsPerBurst; r++, index++) {
+                    busyWait(service[index]);
+                }
+                this_thread::sleep_for(config.gap);
+            }
+        });
+        report("bursty requests (20 bursts x 1000, 5-50us)", seq, threadCounts, [&](int threads) {
+            return withPool(threads, [&](ThreadPool& pool) { burstyParallel(pool, config, service); });
+        }, true);
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "channel.hpp"
+#include "cpubudget.hpp"
+#include <algorithm>
+
+void ThreadWaiter::wake() {
+    unique_lock<mutex> lock(mutex_);
+    woken_ = true;
+    cond_.notify_one();
+}
+
+void ThreadWaiter::wait() {
+    /*
+    * send、recv和Select::wait都在这里阻塞，工作线程阻塞期间临时归还CPU预算槽位
+    */
+    CpuBudget::BlockingRegion region;
+    unique_lock<mutex> lock(mutex_);
+    cond_.wait(lock, [&]()->bool { return woken_; });
+}
+
+void CoroutineWaiter::prepare(coroutine_handle<> handle) {
+    handle_ = handle;
+    pool_ = currentCoroutinePool();
+}
+
+void CoroutineWaiter::wake() {
+    resumeOnPool(pool_, handle_);
+}
+
+void Select::lockAll() {
+    if(lockOrder_.empty()) {
+        for(unique_ptr<SelectCase>& c : cases_) {
+            lockOrder_.push_back(&c->channel());
+        }
+        sort(lockOrder_.begin(), lockOrder_.end());
+        lockOrder_.erase(unique(lockOrder_.begin(), lockOrder_.end()), lockOrder_.end());
+    }
+    for(ChannelBase* ch : lockOrder_) {
+        ch->chanMutex.lock();
+    }
+}
+
+void Select::unlockAll() {
+    for(auto it = lockOrder_.rbegin(); it != lockOrder_.rend(); ++it) {
+        (*it)->chanMutex.unlock();
+    }
+}
+
+bool Select::tryOrRegister(ChannelWaiter* waiter, bool block) {
+    /*
+    * 每次从不同的分支开始检查，避免总是偏向第一个分支
+    */
+    thread_local size_t rotation = 0;
+    size_t count = cases_.size();
+    size_t start = count > 0 ? rotation++ % count : 0;
+
+    index_ = -1;
+    ok_ = false;
+    ChannelWaiter* woken = nullptr;
+
+    lockAll();
+    for(size_t k = 0; k < count; k++) {
+        size_t i = (start + k) % count;
+        if(cases_[i]->tryLocked(ok_, woken)) {
+            index_ = static_cast<int>(i);
+            unlockAll();
+            if(woken != nullptr) {
+                woken->wake();
+            }
+            return true;
+        }
+    }
+
+    if(!block) {
+        unlockAll();
+        return true;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        cases_[i]->enqueueLocked(waiter, static_cast<int>(i), &ok_);
+    }
+    unlockAll();
+    return false;
+}
+
+void Select::finish(ChannelWaiter* waiter) {
+    lockAll();
+    for(unique_ptr<SelectCase>& c : cases_) {
+        c->dequeueLocked(waiter);
+    }
+    unlockAll();
+    index_ = waiter->selected();
+}
+
+int Select::wait() {
+    ThreadWaiter waiter;
+    if(tryOrRegister(&waiter, true)) {
+        return index_;
+    }
+    waiter.wait();
+    finish(&waiter);
+    return index_;
+}
+
+int Select::poll() {
+    tryOrRegister(nullptr, false);
+    return index_;
+}
+
+bool Select::ok() const {
+    return ok_;
+}
+
+SelectAwaiter Select::operator co_await() {
+    return SelectAwaiter(*this);
+}
+
+bool SelectAwaiter::await_suspend(coroutine_handle<> handle) {
+    waiter_.prepare(handle);
+
+    /*
+    * 登记后释放锁就可能被其他线程恢复，所以先设置registered_
+    */
+    registered_ = true;
+    if(sel_.tryOrRegister(&waiter_, true)) {
+        registered_ = false;
+        return false;
+    }
+    return true;
+}
+
+int SelectAwaiter::await_resume() {
+    if(registered_) {
+        sel_.finish(&waiter_);
+    }
+    return sel_.index_;
+}
@@ -0,0 +1,549 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "coroutine.hpp"
+#include <cstdint>
+#include <deque>
+
+/*
+* 阻塞在通道上的一方，可能是线程也可能是协程
+* 一个等待者可以同时挂在多个通道上（select），selected记录最终由哪个分支唤醒，
+* 通过CAS保证只有一个分支能够完成
+*/
+class ChannelWaiter {
+public:
+    ChannelWaiter() : selected_(-1) {}
+    virtual ~ChannelWaiter() = default;
+
+    bool trySelect(int index) {
+        int expected = -1;
+        return selected_.compare_exchange_strong(expected, index, memory_order_acq_rel);
+    }
+
+    int selected() const {
+        return selected_.load(memory_order_acquire);
+    }
+
+    virtual void wake() = 0;
+
+private:
+    atomic_int selected_;
+};
+
+/*
+* 阻塞线程的等待者
+*/
+class ThreadWaiter : public ChannelWaiter {
+public:
+    ThreadWaiter() : woken_(false) {}
+
+    void wake();
+    void wait();
+
+private:
+    bool woken_;
+    mutex mutex_;
+    condition_variable cond_;
+};
+
+/*
+* 挂起协程的等待者，唤醒时把协程投递回它所在的线程池，不占用任何工作线程
+*/
+class CoroutineWaiter : public ChannelWaiter {
+public:
+    CoroutineWaiter() : pool_(nullptr) {}
+
+    void prepare(coroutine_handle<> handle);
+    void wake();
+
+private:
+    coroutine_handle<> handle_;
+    ThreadPool* pool_;
+};
+
+/*
+* 所有通道的公共部分，select按照地址顺序对多个通道加锁，避免死锁
+*/
+class ChannelBase {
+public:
+    virtual ~ChannelBase() = default;
+
+    mutex chanMutex;
+};
+
+template<typename T>
+class RecvAwaiter;
+
+template<typename T>
+class SendAwaiter;
+
+/*
+* example:
+* Channel<int> ch(16);
+* thread producer([&]() {
+*     for(int i = 0; i < 100; i++) {
+*         ch.send(i);
+*     }
+*     ch.close();
+* });
+* int value;
+* while(ch.recv(value)) {...}
+*
+* Go风格的类型化通道
+* capacity为0时是无缓冲通道，发送方和接收方直接交接；capacity为UNBOUNDED时发送永远不阻塞。
+* 有接收方在等待时，发送方把值直接写入接收方并唤醒它，不经过缓冲区。
+* 线程中使用send/recv会阻塞线程，协程中使用co_await asyncSend/asyncRecv只挂起协程。
+* 向已关闭的通道发送返回false；从已关闭的通道接收，缓冲区取完后返回false。
+*/
+template<typename T>
+class Channel : public ChannelBase {
+public:
+    static constexpr size_t UNBOUNDED = SIZE_MAX;
+
+    Channel(size_t capacity = 0) : capacity_(capacity), closed_(false) {}
+
+    Channel(const Channel&) = delete;
+    Channel& operator = (const Channel&) = delete;
+
+    bool send(T value) {
+        ThreadWaiter waiter;
+        bool ok = false;
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(chanMutex);
+            if(!sendLocked(value, ok, woken)) {
+                addSender(&waiter, 0, &value, &ok);
+                lock.unlock();
+                waiter.wait();
+                return ok;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return ok;
+    }
+
+    bool recv(T& out) {
+        ThreadWaiter waiter;
+        bool ok = false;
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(chanMutex);
+            if(!recvLocked(out, ok, woken)) {
+                addReceiver(&waiter, 0, &out, &ok);
+                lock.unlock();
+                waiter.wait();
+                return ok;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return ok;
+    }
+
+    /*
+    * 非阻塞发送，发送成功返回true；通道已满或已关闭返回false，value保持不变
+    */
+    bool trySend(T& value) {
+        bool ok = false;
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(chanMutex);
+            if(closed_ || !sendLocked(value, ok, woken)) {
+                return false;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return ok;
+    }
+
+    /*
+    * 非阻塞接收，没有数据返回false
+    */
+    bool tryRecv(T& out) {
+        bool ok = false;
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(chanMutex);
+            if(!recvLocked(out, ok, woken)) {
+                return false;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return ok;
+    }
+
+    /*
+    * 协程中使用：bool ok = co_await ch.asyncSend(value);
+    */
+    SendAwaiter<T> asyncSend(T value) {
+        return SendAwaiter<T>(*this, move(value));
+    }
+
+    /*
+    * 协程中使用：bool ok = co_await ch.asyncRecv(value);
+    */
+    RecvAwaiter<T> asyncRecv(T& out) {
+        return RecvAwaiter<T>(*this, out);
+    }
+
+    /*
+    * 关闭通道，唤醒所有等待者，等待中的发送和接收都返回false
+    */
+    void close() {
+        vector<ChannelWaiter*> woken;
+        {
+            unique_lock<mutex> lock(chanMutex);
+            closed_ = true;
+            for(deque<Entry>* entries : {&receivers_, &senders_}) {
+                for(Entry& e : *entries) {
+                    if(e.waiter->trySelect(e.index)) {
+                        *e.ok = false;
+                        woken.push_back(e.waiter);
+                    }
+                }
+                entries->clear();
+            }
+        }
+        for(ChannelWaiter* waiter : woken) {
+            waiter->wake();
+        }
+    }
+
+    bool isClosed() {
+        unique_lock<mutex> lock(chanMutex);
+        return closed_;
+    }
+
+    /*
+    * 以下接口供select和awaiter使用，调用前需持有chanMutex
+    * 返回true表示操作已经完成（ok为false表示通道已关闭），woken是需要在释放锁后唤醒的对端
+    */
+    bool sendLocked(T& value, bool& ok, ChannelWaiter*& woken) {
+        if(closed_) {
+            ok = false;
+            return true;
+        }
+
+        /*
+        * 直接交给等待中的接收方，已经被其他分支选中的接收方直接丢弃
+        */
+        while(!receivers_.empty()) {
+            Entry e = receivers_.front();
+            receivers_.pop_front();
+            if(e.waiter->trySelect(e.index)) {
+                *e.data = move(value);
+                *e.ok = true;
+                woken = e.waiter;
+                ok = true;
+                return true;
+            }
+        }
+
+        if(buffer_.size() < capacity_) {
+            buffer_.push_back(move(value));
+            ok = true;
+            return true;
+        }
+        return false;
+    }
+
+    bool recvLocked(T& out, bool& ok, ChannelWaiter*& woken) {
+        if(!buffer_.empty()) {
+            out = move(buffer_.front());
+            buffer_.pop_front();
+
+            /*
+            * 缓冲区腾出了位置，把一个等待中的发送方的值补进来
+            */
+            while(!senders_.empty()) {
+                Entry e = senders_.front();
+                senders_.pop_front();
+                if(e.waiter->trySelect(e.index)) {
+                    buffer_.push_back(move(*e.data));
+                    *e.ok = true;
+                    woken = e.waiter;
+                    break;
+                }
+            }
+            ok = true;
+            return true;
+        }
+
+        while(!senders_.empty()) {
+            Entry e = senders_.front();
+            senders_.pop_front();
+            if(e.waiter->trySelect(e.index)) {
+                out = move(*e.data);
+                *e.ok = true;
+                woken = e.waiter;
+                ok = true;
+                return true;
+            }
+        }
+
+        if(closed_) {
+            ok = false;
+            return true;
+        }
+        return false;
+    }
+
+    void addSender(ChannelWaiter* waiter, int index, T* value, bool* ok) {
+        senders_.push_back(Entry{waiter, index, value, ok});
+    }
+
+    void addReceiver(ChannelWaiter* waiter, int index, T* slot, bool* ok) {
+        receivers_.push_back(Entry{waiter, index, slot, ok});
+    }
+
+    void removeWaiter(ChannelWaiter* waiter) {
+        for(deque<Entry>* entries : {&receivers_, &senders_}) {
+            for(auto it = entries->begin(); it != entries->end();) {
+                it = it->waiter == waiter ? entries->erase(it) : it + 1;
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        ChannelWaiter* waiter;
+        int index;
+        T* data;
+        bool* ok;
+    };
+
+    size_t capacity_;
+    bool closed_;
+    deque<T> buffer_;
+    deque<Entry> senders_;
+    deque<Entry> receivers_;
+};
+
+template<typename T>
+class RecvAwaiter {
+public:
+    RecvAwaiter(Channel<T>& ch, T& out) : ch_(ch), out_(out), ok_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    /*
+    * 检查和登记在同一把锁内完成；登记后释放锁就可能被其他线程恢复，之后不能再访问awaiter
+    */
+    bool await_suspend(coroutine_handle<> handle) {
+        waiter_.prepare(handle);
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(ch_.chanMutex);
+            if(!ch_.recvLocked(out_, ok_, woken)) {
+                ch_.addReceiver(&waiter_, 0, &out_, &ok_);
+                return true;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return false;
+    }
+
+    bool await_resume() const noexcept { return ok_; }
+
+private:
+    Channel<T>& ch_;
+    T& out_;
+    bool ok_;
+    CoroutineWaiter waiter_;
+};
+
+template<typename T>
+class SendAwaiter {
+public:
+    SendAwaiter(Channel<T>& ch, T value) : ch_(ch), value_(move(value)), ok_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(coroutine_handle<> handle) {
+        waiter_.prepare(handle);
+        ChannelWaiter* woken = nullptr;
+        {
+            unique_lock<mutex> lock(ch_.chanMutex);
+            if(!ch_.sendLocked(value_, ok_, woken)) {
+                ch_.addSender(&waiter_, 0, &value_, &ok_);
+                return true;
+            }
+        }
+        if(woken != nullptr) {
+            woken->wake();
+        }
+        return false;
+    }
+
+    bool await_resume() const noexcept { return ok_; }
+
+private:
+    Channel<T>& ch_;
+    T value_;
+    bool ok_;
+    CoroutineWaiter waiter_;
+};
+
+/*
+* select的一个分支
+*/
+class SelectCase {
+public:
+    virtual ~SelectCase() = default;
+
+    virtual ChannelBase& channel() = 0;
+
+    /*
+    * 以下接口调用前需持有channel().chanMutex
+    */
+    virtual bool tryLocked(bool& ok, ChannelWaiter*& woken) = 0;
+    virtual void enqueueLocked(ChannelWaiter* waiter, int index, bool* ok) = 0;
+    virtual void dequeueLocked(ChannelWaiter* waiter) = 0;
+};
+
+template<typename T>
+class RecvCase : public SelectCase {
+public:
+    RecvCase(Channel<T>& ch, T& out) : ch_(ch), out_(out) {}
+
+    ChannelBase& channel() { return ch_; }
+
+    bool tryLocked(bool& ok, ChannelWaiter*& woken) {
+        return ch_.recvLocked(out_, ok, woken);
+    }
+
+    void enqueueLocked(ChannelWaiter* waiter, int index, bool* ok) {
+        ch_.addReceiver(waiter, index, &out_, ok);
+    }
+
+    void dequeueLocked(ChannelWaiter* waiter) {
+        ch_.removeWaiter(waiter);
+    }
+
+private:
+    Channel<T>& ch_;
+    T& out_;
+};
+
+template<typename T>
+class SendCase : public SelectCase {
+public:
+    SendCase(Channel<T>& ch, T value) : ch_(ch), value_(move(value)) {}
+
+    ChannelBase& channel() { return ch_; }
+
+    bool tryLocked(bool& ok, ChannelWaiter*& woken) {
+        return ch_.sendLocked(value_, ok, woken);
+    }
+
+    void enqueueLocked(ChannelWaiter* waiter, int index, bool* ok) {
+        ch_.addSender(waiter, index, &value_, ok);
+    }
+
+    void dequeueLocked(ChannelWaiter* waiter) {
+        ch_.removeWaiter(waiter);
+    }
+
+private:
+    Channel<T>& ch_;
+    T value_;
+};
+
+class SelectAwaiter;
+
+/*
+* example:
+* int a;
+* string b;
+* Select sel;
+* sel.recv(ch1, a).recv(ch2, b).send(ch3, 42);
+* int index = sel.wait();        // 线程中阻塞等待
+* int index = co_await sel;      // 协程中挂起等待
+* if(sel.ok()) {...}
+*
+* 同时等待多个通道操作，返回最先完成的分支下标（按添加顺序），只有这一个分支生效。
+* ok()为false表示该分支对应的通道已经关闭。
+* 实现与Go相同：按地址顺序锁住所有通道，检查是否有可以立即完成的分支，没有就在所有通道上登记等待。
+*/
+class Select {
+public:
+    Select() : index_(-1), ok_(false) {}
+
+    Select(const Select&) = delete;
+    Select& operator = (const Select&) = delete;
+
+    template<typename T>
+    Select& recv(Channel<T>& ch, T& out) {
+        cases_.emplace_back(make_unique<RecvCase<T>>(ch, out));
+        return *this;
+    }
+
+    template<typename T>
+    Select& send(Channel<T>& ch, T value) {
+        cases_.emplace_back(make_unique<SendCase<T>>(ch, move(value)));
+        return *this;
+    }
+
+    /*
+    * 阻塞当前线程直到某个分支完成
+    */
+    int wait();
+
+    /*
+    * 非阻塞，没有可以立即完成的分支时返回-1
+    */
+    int poll();
+
+    bool ok() const;
+
+    SelectAwaiter operator co_await();
+
+private:
+    friend class SelectAwaiter;
+
+    void lockAll();
+    void unlockAll();
+
+    /*
+    * 有分支可以立即完成时执行它并返回true；否则block为true时在所有通道上登记waiter并返回false
+    */
+    bool tryOrRegister(ChannelWaiter* waiter, bool block);
+
+    /*
+    * 被唤醒后从所有通道上注销waiter
+    */
+    void finish(ChannelWaiter* waiter);
+
+private:
+    vector<unique_ptr<SelectCase>> cases_;
+    vector<ChannelBase*> lockOrder_;
+    int index_;
+    bool ok_;
+};
+
+class SelectAwaiter {
+public:
+    SelectAwaiter(Select& sel) : sel_(sel), registered_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(coroutine_handle<> handle);
+
+    int await_resume();
+
+private:
+    Select& sel_;
+    bool registered_;
+    CoroutineWaiter waiter_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "completionqueue.hpp"
+#include "cpubudget.hpp"
+
+/*
+* 包装用户任务，执行完成后把返回值投递到完成队列，而不是写入Result
+*/
+class CompletionTask : public Task {
+public:
+    CompletionTask(shared_ptr<Task> task, shared_ptr<CompletionQueue::Shared> shared, uint64_t tag)
+        : task_(move(task)), shared_(move(shared)), tag_(tag)
+    {}
+
+    /*
+    * 通过exec执行被包装的任务，取消和this_task::current()对它同样有效；
+    * 临时绑定的Result在exec返回时已经得到结果，get不会阻塞
+    */
+    Any run() {
+        Result res(task_);
+        task_->exec();
+        shared_->push(tag_, res.get());
+        return Any();
+    }
+private:
+    shared_ptr<Task> task_;
+    shared_ptr<CompletionQueue::Shared> shared_;
+    uint64_t tag_;
+};
+
+CompletionQueue::Shared::Shared()
+    :head(nullptr)
+     ,sleeping(false)
+{}
+
+CompletionQueue::Shared::~Shared() {
+    Node* node = head.exchange(nullptr);
+    while(node != nullptr) {
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+void CompletionQueue::Shared::push(uint64_t tag, Any value) {
+    Node* node = new Node{tag, move(value), head.load(memory_order_relaxed)};
+    while(!head.compare_exchange_weak(node->next, node,
+                                      memory_order_seq_cst, memory_order_relaxed)) {}
+
+    /*
+    * 消费者没有睡眠时不碰锁，避免每个完成事件都产生一次系统调用
+    */
+    if(sleeping.load(memory_order_seq_cst) && sleeping.exchange(false)) {
+        lock_guard<mutex> lock(sleepMutex);
+        sleepCond.notify_one();
+    }
+}
+
+CompletionQueue::CompletionQueue()
+    :shared_(make_shared<Shared>())
+{}
+
+CompletionQueue::~CompletionQueue() = default;
+
+bool CompletionQueue::submit(ThreadPool& pool, shared_ptr<Task> task, uint64_t tag) {
+    return pool.execute(make_shared<CompletionTask>(move(task), shared_, tag));
+}
+
+void CompletionQueue::push(uint64_t tag, Any value) {
+    shared_->push(tag, move(value));
+}
+
+void CompletionQueue::harvest() {
+    Node* node = shared_->head.exchange(nullptr, memory_order_acquire);
+
+    /*
+    * 栈中的节点是逆序的，反转后得到完成顺序
+    */
+    Node* ordered = nullptr;
+    while(node != nullptr) {
+        Node* next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+
+    while(ordered != nullptr) {
+        Node* next = ordered->next;
+        ready_.push_back(Completion{ordered->tag, move(ordered->value)});
+        delete ordered;
+        ordered = next;
+    }
+}
+
+size_t CompletionQueue::poll(vector<Completion>& out, size_t batch) {
+    if(ready_.size() < batch) {
+        harvest();
+    }
+
+    size_t count = 0;
+    while(count < batch && !ready_.empty()) {
+        out.push_back(move(ready_.front()));
+        ready_.pop_front();
+        count++;
+    }
+    return count;
+}
+
+size_t CompletionQueue::waitAny(vector<Completion>& out, size_t batch, chrono::milliseconds timeout) {
+    size_t count = poll(out, batch);
+    if(count > 0) {
+        return count;
+    }
+
+    /*
+    * 先标记睡眠再检查一次队列，与生产者的"先入栈再检查标识"配对，不会丢失唤醒
+    */
+    Shared& shared = *shared_;
+    shared.sleeping.store(true, memory_order_seq_cst);
+    if(shared.head.load(memory_order_seq_cst) == nullptr) {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(shared.sleepMutex);
+        shared.sleepCond.wait_for(lock, timeout, [&]()->bool { return !shared.sleeping.load(); });
+    }
+    shared.sleeping.store(false);
+
+    return poll(out, batch);
+}
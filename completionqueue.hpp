@@ -0,0 +1,105 @@
+#ifndef COMPLETIONQUEUE_H
+#define COMPLETIONQUEUE_H
+
+#include "threadpool.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+/*
+* 完成事件，tag由提交者指定，用于区分是哪个任务完成了
+*/
+struct Completion {
+    uint64_t tag;
+    Any value;
+};
+
+/*
+* example:
+* CompletionQueue cq;
+* cq.submit(pool, make_shared<MyTask>(0, 16384), 1);
+* cq.submit(pool, make_shared<MyTask>(16385, 32768), 2);
+* vector<Completion> done;
+* while(cq.waitAny(done, 16, chrono::milliseconds(100)) > 0) {...}
+*
+* 类似io_uring的CQ或IOCP：工作线程把执行结果无锁地压入完成队列，消费者按完成顺序批量收割，
+* 不需要按提交顺序逐个阻塞在Result::get()上。
+* 只允许一个消费者线程调用poll/waitAny，生产者（工作线程）数量不限。
+*/
+class CompletionQueue {
+public:
+    CompletionQueue();
+    ~CompletionQueue();
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator = (const CompletionQueue&) = delete;
+
+    /*
+    * 提交绑定到该完成队列的任务，任务执行完成后以tag为标识放入完成队列
+    * 线程池队列已满时返回false，任务不会被执行
+    */
+    bool submit(ThreadPool& pool, shared_ptr<Task> task, uint64_t tag);
+
+    /*
+    * 放入完成事件，由工作线程调用，无锁
+    */
+    void push(uint64_t tag, Any value);
+
+    /*
+    * 非阻塞地取出最多batch个完成事件追加到out，返回取出的数量
+    */
+    size_t poll(vector<Completion>& out, size_t batch);
+
+    /*
+    * 至少等到一个完成事件或者超时，然后取出最多batch个完成事件，超时返回0
+    */
+    size_t waitAny(vector<Completion>& out, size_t batch, chrono::milliseconds timeout);
+
+private:
+    struct Node {
+        uint64_t tag;
+        Any value;
+        Node* next;
+    };
+
+    /*
+    * 生产者和消费者共享的状态，在途的任务持有它的shared_ptr，
+    * 完成队列先于任务销毁时，任务完成后压入的节点随最后一个引用一起释放
+    */
+    struct Shared {
+        Shared();
+        ~Shared();
+
+        void push(uint64_t tag, Any value);
+
+        /*
+        * 生产者使用的无锁栈
+        */
+        atomic<Node*> head;
+
+        /*
+        * 消费者睡眠标识，只有第一个看到该标识的生产者负责唤醒，一批完成事件只唤醒一次
+        */
+        atomic_bool sleeping;
+        mutex sleepMutex;
+        condition_variable sleepCond;
+    };
+
+    friend class CompletionTask;
+
+    /*
+    * 把生产者压入的节点一次性全部摘下，按完成顺序放入ready_
+    */
+    void harvest();
+
+private:
+    shared_ptr<Shared> shared_;
+
+    /*
+    * 已收割但还没有交给消费者的完成事件，只有消费者线程访问
+    */
+    deque<Completion> ready_;
+};
+
+#endif
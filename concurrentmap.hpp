@@ -0,0 +1,272 @@
+#ifndef CONCURRENTMAP_H
+#define CONCURRENTMAP_H
+
+#include "parallel.hpp"
+#include <shared_mutex>
+#include <unordered_map>
+
+/*
+* example:
+* ConcurrentHashMap<string, long> counts;
+* counts.upsert(word, 1, [](long& v) { v++; });
+* long n;
+* if(counts.find(word, n)) {...}
+*
+* 分段锁哈希表：按哈希值分成若干段，每段一个读写锁和一个unordered_map，
+* 不同段之间的读写互不影响，同一段的并发读取只加共享锁。
+*/
+template<typename K, typename V, typename Hash = hash<K>>
+class ConcurrentHashMap {
+public:
+    using Map = unordered_map<K, V, Hash>;
+
+    ConcurrentHashMap(size_t stripeCount = 64)
+        : stripeCount_(stripeCount > 0 ? stripeCount : 1)
+        , stripes_(new Stripe[stripeCount_])
+    {}
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator = (const ConcurrentHashMap&) = delete;
+
+    bool find(const K& key, V& out) const {
+        const Stripe& stripe = stripes_[stripeOf(key)];
+        shared_lock<shared_mutex> lock(stripe.stripeMutex);
+        auto it = stripe.map.find(key);
+        if(it == stripe.map.end()) {
+            return false;
+        }
+        out = it->second;
+        return true;
+    }
+
+    bool contains(const K& key) const {
+        const Stripe& stripe = stripes_[stripeOf(key)];
+        shared_lock<shared_mutex> lock(stripe.stripeMutex);
+        return stripe.map.find(key) != stripe.map.end();
+    }
+
+    /*
+    * key不存在时插入，返回是否插入
+    */
+    bool insert(const K& key, V value) {
+        Stripe& stripe = stripes_[stripeOf(key)];
+        unique_lock<shared_mutex> lock(stripe.stripeMutex);
+        return stripe.map.emplace(key, move(value)).second;
+    }
+
+    void insertOrAssign(const K& key, V value) {
+        Stripe& stripe = stripes_[stripeOf(key)];
+        unique_lock<shared_mutex> lock(stripe.stripeMutex);
+        stripe.map.insert_or_assign(key, move(value));
+    }
+
+    /*
+    * key不存在时插入init，存在时在锁内调用update(value)修改
+    */
+    template<typename F>
+    void upsert(const K& key, const V& init, F update) {
+        Stripe& stripe = stripes_[stripeOf(key)];
+        unique_lock<shared_mutex> lock(stripe.stripeMutex);
+        auto result = stripe.map.emplace(key, init);
+        if(!result.second) {
+            update(result.first->second);
+        }
+    }
+
+    bool erase(const K& key) {
+        Stripe& stripe = stripes_[stripeOf(key)];
+        unique_lock<shared_mutex> lock(stripe.stripeMutex);
+        return stripe.map.erase(key) > 0;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for(size_t i = 0; i < stripeCount_; i++) {
+            shared_lock<shared_mutex> lock(stripes_[i].stripeMutex);
+            total += stripes_[i].map.size();
+        }
+        return total;
+    }
+
+    /*
+    * 逐段遍历，遍历某一段时持有该段的共享锁，不是整个表的一致快照
+    */
+    template<typename F>
+    void forEach(F func) const {
+        for(size_t i = 0; i < stripeCount_; i++) {
+            shared_lock<shared_mutex> lock(stripes_[i].stripeMutex);
+            for(const auto& kv : stripes_[i].map) {
+                func(kv.first, kv.second);
+            }
+        }
+    }
+
+    /*
+    * 转换成普通的unordered_map
+    */
+    Map snapshot() const {
+        Map result;
+        forEach([&](const K& key, const V& value) { result.emplace(key, value); });
+        return result;
+    }
+
+    size_t stripeCount() const {
+        return stripeCount_;
+    }
+
+    size_t stripeOf(const K& key) const {
+        /*
+        * unordered_map内部用低位选桶，这里混合后取高位选段，避免每段内部的桶分布退化
+        */
+        uint64_t h = hasher_(key);
+        return static_cast<size_t>(((h ^ (h >> 32)) * 0x9E3779B97F4A7C15ULL) >> 32) % stripeCount_;
+    }
+
+    /*
+    * 在持有第i段独占锁的情况下调用func(map)，供批量合并使用
+    */
+    template<typename F>
+    void withStripe(size_t i, F func) {
+        unique_lock<shared_mutex> lock(stripes_[i].stripeMutex);
+        func(stripes_[i].map);
+    }
+
+private:
+    struct alignas(64) Stripe {
+        mutable shared_mutex stripeMutex;
+        Map map;
+    };
+
+    size_t stripeCount_;
+    unique_ptr<Stripe[]> stripes_;
+    Hash hasher_;
+};
+
+/*
+* example:
+* CombiningBuffers<string, long> partial;
+* parallel_for(pool, files.size(), [&](size_t i) {
+*     for(const string& word : read(files[i])) {
+*         partial.add(word, 1);
+*     }
+* });
+* ConcurrentHashMap<string, long> counts;
+* parallel_merge_into(pool, partial, counts);
+*
+* 每个线程一个本地的unordered_map，聚合阶段完全不加锁，最后再并行合并到ConcurrentHashMap，
+* 取代所有线程共用一个mutex加一个unordered_map的写法。
+* combine用于合并同一个key的两个值，默认是加法。
+*/
+template<typename K, typename V, typename Hash = hash<K>, typename Combine = plus<V>>
+class CombiningBuffers {
+public:
+    using Map = unordered_map<K, V, Hash>;
+
+    CombiningBuffers(Combine combine = Combine()) : combine_(combine), id_(nextId()) {}
+
+    CombiningBuffers(const CombiningBuffers&) = delete;
+    CombiningBuffers& operator = (const CombiningBuffers&) = delete;
+
+    /*
+    * 当前线程的本地缓冲区，第一次访问时创建
+    */
+    Map& local() {
+        thread_local vector<pair<uint64_t, Map*>> cache;
+        for(pair<uint64_t, Map*>& entry : cache) {
+            if(entry.first == id_) {
+                return *entry.second;
+            }
+        }
+
+        unique_lock<mutex> lock(buffersMutex_);
+        buffers_.emplace_back(make_unique<Map>());
+        Map* map = buffers_.back().get();
+        lock.unlock();
+
+        /*
+        * 缓存中可能残留已经析构的CombiningBuffers的记录，id不会重复，超过一定数量时清理
+        */
+        if(cache.size() >= 64) {
+            cache.erase(cache.begin());
+        }
+        cache.emplace_back(id_, map);
+        return *map;
+    }
+
+    void add(const K& key, const V& value) {
+        Map& map = local();
+        auto result = map.emplace(key, value);
+        if(!result.second) {
+            result.first->second = combine_(result.first->second, value);
+        }
+    }
+
+    /*
+    * 合并阶段使用，调用时不能再有线程在add
+    */
+    vector<unique_ptr<Map>>& buffers() {
+        return buffers_;
+    }
+
+    const Combine& combiner() const {
+        return combine_;
+    }
+
+private:
+    static uint64_t nextId() {
+        static atomic<uint64_t> id{1};
+        return id.fetch_add(1, memory_order_relaxed);
+    }
+
+    Combine combine_;
+    uint64_t id_;
+    mutex buffersMutex_;
+    vector<unique_ptr<Map>> buffers_;
+};
+
+/*
+* 把多个局部结果并行合并到target
+* 第一阶段每个局部结果一个任务，按目标段把元素分组；第二阶段每个目标段一个任务，只写自己的段，
+* 两个阶段都没有锁竞争
+*/
+template<typename K, typename V, typename Hash, typename Combine>
+void parallel_merge_into(ThreadPool& pool,
+                         const vector<const unordered_map<K, V, Hash>*>& partials,
+                         ConcurrentHashMap<K, V, Hash>& target,
+                         Combine combine) {
+    size_t stripes = target.stripeCount();
+    vector<vector<vector<const pair<const K, V>*>>> grouped(partials.size());
+
+    parallel_for(pool, partials.size(), [&](size_t p) {
+        grouped[p].resize(stripes);
+        for(const pair<const K, V>& kv : *partials[p]) {
+            grouped[p][target.stripeOf(kv.first)].push_back(&kv);
+        }
+    });
+
+    parallel_for(pool, stripes, [&](size_t s) {
+        target.withStripe(s, [&](unordered_map<K, V, Hash>& map) {
+            for(size_t p = 0; p < partials.size(); p++) {
+                for(const pair<const K, V>* kv : grouped[p][s]) {
+                    auto result = map.emplace(kv->first, kv->second);
+                    if(!result.second) {
+                        result.first->second = combine(result.first->second, kv->second);
+                    }
+                }
+            }
+        });
+    });
+}
+
+template<typename K, typename V, typename Hash, typename Combine>
+void parallel_merge_into(ThreadPool& pool,
+                         CombiningBuffers<K, V, Hash, Combine>& buffers,
+                         ConcurrentHashMap<K, V, Hash>& target) {
+    vector<const unordered_map<K, V, Hash>*> partials;
+    for(unique_ptr<unordered_map<K, V, Hash>>& map : buffers.buffers()) {
+        partials.push_back(map.get());
+    }
+    parallel_merge_into(pool, partials, target, buffers.combiner());
+}
+
+#endif
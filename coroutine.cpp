@@ -0,0 +1,20 @@
+#include "coroutine.hpp"
+
+static thread_local ThreadPool* coroutinePool = nullptr;
+
+void resumeOnPool(ThreadPool* pool, coroutine_handle<> handle) {
+    auto resume = [pool, handle]() {
+        ThreadPool* prev = coroutinePool;
+        coroutinePool = pool;
+        handle.resume();
+        coroutinePool = prev;
+    };
+
+    if(pool == nullptr || !pool->tryExecute(resume)) {
+        resume();
+    }
+}
+
+ThreadPool* currentCoroutinePool() {
+    return coroutinePool;
+}
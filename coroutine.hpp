@@ -0,0 +1,160 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include <coroutine>
+
+/*
+* 协程在线程池中恢复执行：把resume包装成任务投递到pool，pool为空或者拒绝任务时在当前线程恢复
+* 协程挂起时不占用工作线程，恢复时可能在任意一个工作线程上继续执行
+*/
+void resumeOnPool(ThreadPool* pool, coroutine_handle<> handle);
+
+/*
+* 当前工作线程正在恢复的协程所属的线程池，不在协程中时返回nullptr
+* 挂起协程的同步原语用它决定在哪个线程池中唤醒协程
+*/
+ThreadPool* currentCoroutinePool();
+
+/*
+* 协程结束状态，Coroutine对象销毁后协程仍然可能在运行，所以单独用shared_ptr保存
+*/
+class CoroutineState {
+public:
+    CoroutineState() : done_(false) {}
+
+    void finish() {
+        unique_lock<mutex> lock(mutex_);
+        done_ = true;
+        cond_.notify_all();
+    }
+
+    void wait() {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        cond_.wait(lock, [&]()->bool { return done_; });
+    }
+
+    bool done() {
+        unique_lock<mutex> lock(mutex_);
+        return done_;
+    }
+
+private:
+    bool done_;
+    mutex mutex_;
+    condition_variable cond_;
+};
+
+/*
+* example:
+* Coroutine producer(Channel<int>& ch) {
+*     for(int i = 0; i < 100; i++) {
+*         co_await ch.asyncSend(i);
+*     }
+*     ch.close();
+* }
+*
+* Coroutine co = producer(ch);
+* co.start(pool);
+* co.join();
+*
+* 运行在线程池上的协程，创建后处于挂起状态，调用start后在线程池中开始执行，
+* 执行完毕后协程帧自动销毁，join等待协程执行完毕
+*/
+class Coroutine {
+public:
+    struct promise_type {
+        promise_type() : state(make_shared<CoroutineState>()) {}
+
+        Coroutine get_return_object() {
+            return Coroutine(coroutine_handle<promise_type>::from_promise(*this), state);
+        }
+
+        suspend_always initial_suspend() noexcept { return {}; }
+
+        suspend_never final_suspend() noexcept {
+            state->finish();
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            terminate();
+        }
+
+        shared_ptr<CoroutineState> state;
+    };
+
+    Coroutine(Coroutine&& other) noexcept
+        : handle_(other.handle_), state_(move(other.state_)) {
+        other.handle_ = nullptr;
+    }
+
+    /*
+    * 没有start的协程由Coroutine负责销毁
+    */
+    ~Coroutine() {
+        if(handle_) {
+            handle_.destroy();
+        }
+    }
+
+    Coroutine(const Coroutine&) = delete;
+    Coroutine& operator = (const Coroutine&) = delete;
+
+    /*
+    * 在线程池中开始执行，只能调用一次
+    */
+    void start(ThreadPool& pool) {
+        coroutine_handle<promise_type> handle = handle_;
+        handle_ = nullptr;
+        if(handle) {
+            resumeOnPool(&pool, handle);
+        }
+    }
+
+    void join() {
+        state_->wait();
+    }
+
+    bool done() const {
+        return state_->done();
+    }
+
+private:
+    Coroutine(coroutine_handle<promise_type> handle, shared_ptr<CoroutineState> state)
+        : handle_(handle), state_(move(state))
+    {}
+
+private:
+    coroutine_handle<promise_type> handle_;
+    shared_ptr<CoroutineState> state_;
+};
+
+/*
+* co_await switchTo(pool)把当前协程转移到pool中继续执行
+*/
+class SwitchAwaiter {
+public:
+    SwitchAwaiter(ThreadPool& pool) : pool_(pool) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(coroutine_handle<> handle) {
+        resumeOnPool(&pool_, handle);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    ThreadPool& pool_;
+};
+
+inline SwitchAwaiter switchTo(ThreadPool& pool) {
+    return SwitchAwaiter(pool);
+}
+
+#endif
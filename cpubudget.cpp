@@ -0,0 +1,175 @@
+#include "cpubudget.hpp"
+#include "cpuquota.hpp"
+#include "threadpool.hpp"
+#include <thread>
+
+namespace {
+
+/*
+* 当前线程持有的槽位，供BlockingRegion临时归还
+*/
+struct HeldSlot {
+    CpuBudget* budget = nullptr;
+    BudgetMember* member = nullptr;
+};
+
+thread_local HeldSlot heldSlot;
+
+}
+
+CpuBudget::CpuBudget(int slots)
+    :slots_(slots > 0 ? slots : availableCpus())
+     ,used_(0)
+     ,waiters_(0)
+     ,gangWaiters(0)
+{}
+
+CpuBudget& CpuBudget::global() {
+    /*
+    * 故意不析构：分离的工作线程在进程退出时可能仍在访问
+    */
+    static CpuBudget* budget = new CpuBudget();
+    return *budget;
+}
+
+BudgetMember* CpuBudget::join() {
+    unique_ptr<BudgetMember> member = make_unique<BudgetMember>();
+    BudgetMember* handle = member.get();
+    lock_guard<mutex> lock(budgetMutex);
+    members.emplace(handle, move(member));
+
+    /*
+    * 线程池数量变化会改变公平份额
+    */
+    slotFreed.notify_all();
+    return handle;
+}
+
+void CpuBudget::leave(BudgetMember* member) {
+    lock_guard<mutex> lock(budgetMutex);
+    members.erase(member);
+    slotFreed.notify_all();
+}
+
+void CpuBudget::acquire(BudgetMember* member) {
+    /*
+    * 快路径：没有人在排队时直接占用空闲槽位，这也就是把空闲线程池的份额借出去
+    */
+    if(waiters_.load(memory_order_seq_cst) == 0) {
+        int used = used_.load(memory_order_relaxed);
+        while(used < slots_.load(memory_order_relaxed)) {
+            if(used_.compare_exchange_weak(used, used + 1, memory_order_seq_cst)) {
+                member->active.fetch_add(1, memory_order_relaxed);
+                heldSlot = {this, member};
+                return;
+            }
+        }
+    }
+
+    unique_lock<mutex> lock(budgetMutex);
+    waiters_.fetch_add(1, memory_order_seq_cst);
+    member->waiting++;
+    slotFreed.wait(lock, [&]()->bool { return canAcquire(member); });
+    member->waiting--;
+    waiters_.fetch_sub(1, memory_order_seq_cst);
+    used_.fetch_add(1, memory_order_seq_cst);
+    member->active.fetch_add(1, memory_order_relaxed);
+    heldSlot = {this, member};
+}
+
+void CpuBudget::acquireGang(BudgetMember* member, int count) {
+    unique_lock<mutex> lock(budgetMutex);
+    waiters_.fetch_add(1, memory_order_seq_cst);
+    gangWaiters++;
+    slotFreed.wait(lock, [&]()->bool { return canAcquireGang(count); });
+    gangWaiters--;
+    waiters_.fetch_sub(1, memory_order_seq_cst);
+    used_.fetch_add(count, memory_order_seq_cst);
+    member->active.fetch_add(count, memory_order_relaxed);
+
+    /*
+    * 其他等待者可能因为成组任务在等待而被挡住
+    */
+    slotFreed.notify_all();
+}
+
+void CpuBudget::release(BudgetMember* member) {
+    heldSlot = HeldSlot();
+    member->active.fetch_sub(1, memory_order_relaxed);
+    used_.fetch_sub(1, memory_order_seq_cst);
+
+    /*
+    * 与acquire中先登记waiters_再检查used_配对，不会丢失唤醒
+    */
+    if(waiters_.load(memory_order_seq_cst) > 0) {
+        lock_guard<mutex> lock(budgetMutex);
+        slotFreed.notify_all();
+    }
+}
+
+bool CpuBudget::canAcquire(BudgetMember* member) const {
+    /*
+    * 成组任务在等待时不再发放单个槽位，否则它可能永远凑不齐
+    */
+    if(gangWaiters > 0 || used_.load(memory_order_seq_cst) >= slots_.load(memory_order_relaxed)) {
+        return false;
+    }
+    int share = max(1, slots_.load(memory_order_relaxed) / max(1, static_cast<int>(members.size())));
+    if(member->active.load(memory_order_relaxed) < share) {
+        return true;
+    }
+
+    /*
+    * 自己已经用满份额，只有没有其他线程池在份额之内等待时才能借用
+    */
+    for(const auto& entry : members) {
+        BudgetMember* other = entry.first;
+        if(other != member && other->waiting > 0
+            && other->active.load(memory_order_relaxed) < share) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CpuBudget::canAcquireGang(int count) const {
+    int slots = slots_.load(memory_order_relaxed);
+    return used_.load(memory_order_seq_cst) + min(count, slots) <= slots;
+}
+
+void CpuBudget::setSlots(int slots) {
+    slots_.store(max(1, slots), memory_order_relaxed);
+    lock_guard<mutex> lock(budgetMutex);
+    slotFreed.notify_all();
+}
+
+int CpuBudget::getSlots() const {
+    return slots_.load(memory_order_relaxed);
+}
+
+int CpuBudget::getActive() const {
+    return used_.load(memory_order_relaxed);
+}
+
+CpuBudget::BlockingRegion::BlockingRegion()
+    :budget_(heldSlot.budget)
+     ,member_(heldSlot.member)
+{
+    if(budget_ != nullptr) {
+        budget_->release(member_);
+    }
+}
+
+CpuBudget::BlockingRegion::~BlockingRegion() {
+    if(budget_ != nullptr) {
+        budget_->acquire(member_);
+    }
+}
+
+unique_ptr<ThreadPool> makeThreadPool(int size) {
+    CpuBudget& budget = CpuBudget::global();
+    unique_ptr<ThreadPool> pool = make_unique<ThreadPool>();
+    pool->setCpuBudget(budget);
+    pool->start(size > 0 ? size : budget.getSlots());
+    return pool;
+}
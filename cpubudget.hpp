@@ -0,0 +1,138 @@
+#ifndef CPUBUDGET_H
+#define CPUBUDGET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+class ThreadPool;
+
+/*
+* 一个线程池在预算中的登记信息
+*/
+struct BudgetMember {
+    /*
+    * 正在执行任务的工作线程数
+    */
+    atomic_int active{0};
+
+    /*
+    * 等待槽位的工作线程数，只在持有预算锁时访问
+    */
+    int waiting = 0;
+};
+
+/*
+* example:
+* // 通过工厂创建的线程池自动登记到全局预算
+* unique_ptr<ThreadPool> io = makeThreadPool();
+* unique_ptr<ThreadPool> compute = makeThreadPool();
+*
+* 进程级CPU预算，类似TBB的global market
+* 所有登记的线程池共享slots个槽位（默认等于CPU核数），工作线程取到任务后先取得一个槽位再执行，
+* 执行完归还，因此无论创建了多少个线程池、每个线程池启动了多少线程，同时运行任务的线程数都不超过槽位数。
+* 没有线程等待时槽位先到先得，空闲线程池的份额自动借给繁忙的线程池；
+* 一旦有线程池在低于公平份额（slots / 线程池数）时等待，归还的槽位优先给它，借出的份额在任务边界收回。
+* 库内所有阻塞等待（Result::get、parallel_for、SingleFlight、Batcher、OrderedCollector、Coroutine、
+* Channel/Select、CompletionQueue、DirectoryWalker）都在BlockingRegion中进行，阻塞期间临时归还槽位，
+* 避免嵌套提交时所有槽位都被等待者占住。任务中使用其他阻塞原语（Latch、Event、裸条件变量等）时
+* 需要自己用BlockingRegion包裹，否则等待者仍然占用槽位。
+*/
+class CpuBudget {
+public:
+    /*
+    * slots为0时使用availableCpus()
+    */
+    CpuBudget(int slots = 0);
+    ~CpuBudget() = default;
+
+    CpuBudget(const CpuBudget&) = delete;
+    CpuBudget& operator = (const CpuBudget&) = delete;
+
+    /*
+    * 工厂创建的线程池使用的全局预算
+    */
+    static CpuBudget& global();
+
+    /*
+    * 线程池登记和注销，注销前该线程池的工作线程不能再调用acquire
+    */
+    BudgetMember* join();
+    void leave(BudgetMember* member);
+
+    /*
+    * 工作线程执行任务前后调用，acquire可能阻塞直到有可用槽位
+    */
+    void acquire(BudgetMember* member);
+    void release(BudgetMember* member);
+
+    /*
+    * 成组任务一次取得count个槽位，成员结束时各自调用release归还一个
+    * 有成组任务等待时其他线程不再取得槽位，已经占用的槽位归还后优先凑给成组任务；
+    * count超过槽位数（等待期间槽位被调小）时等到预算完全空闲
+    */
+    void acquireGang(BudgetMember* member, int count);
+
+    /*
+    * 调整槽位数，已经在执行的任务不受影响，多出的槽位在归还时收回
+    */
+    void setSlots(int slots);
+    int getSlots() const;
+
+    /*
+    * 当前正在执行任务的线程总数
+    */
+    int getActive() const;
+
+    /*
+    * 在作用域内临时归还当前线程持有的槽位，离开时重新取得；当前线程没有持有槽位时什么都不做
+    * 用于工作线程阻塞等待其他任务的场景
+    */
+    class BlockingRegion {
+    public:
+        BlockingRegion();
+        ~BlockingRegion();
+
+        BlockingRegion(const BlockingRegion&) = delete;
+        BlockingRegion& operator = (const BlockingRegion&) = delete;
+    private:
+        CpuBudget* budget_;
+        BudgetMember* member_;
+    };
+
+private:
+    /*
+    * 持有budgetMutex时判断member能否取得槽位
+    */
+    bool canAcquire(BudgetMember* member) const;
+    bool canAcquireGang(int count) const;
+
+private:
+    atomic_int slots_;
+    atomic_int used_;
+
+    /*
+    * 慢路径上等待的线程总数，不为0时快路径失效，所有取槽位的操作都按公平份额排队
+    */
+    atomic_int waiters_;
+
+    /*
+    * 等待整组槽位的成组任务数，只在持有预算锁时访问
+    */
+    int gangWaiters;
+
+    mutable mutex budgetMutex;
+    condition_variable slotFreed;
+    unordered_map<BudgetMember*, unique_ptr<BudgetMember>> members;
+};
+
+/*
+* 创建登记到全局预算的线程池并启动，size为0时启动与槽位数相同的线程
+*/
+unique_ptr<ThreadPool> makeThreadPool(int size = 0);
+
+#endif
@@ -0,0 +1,209 @@
+#include "cpuquota.hpp"
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include <cmath>
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+int affinityCpuCount() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return max(1, static_cast<int>(thread::hardware_concurrency()));
+    }
+    return max(1, CPU_COUNT(&set));
+}
+
+namespace {
+
+/*
+* 从/proc/self/cgroup中找到cgroup v2的路径（以"0::"开头的一行）
+*/
+string cgroupPath() {
+    ifstream in("/proc/self/cgroup");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, 3, "0::") == 0) {
+            return line.substr(3);
+        }
+    }
+    return "";
+}
+
+/*
+* 解析cpu.max，格式为"quota period"，quota为max表示不限制
+*/
+double readCpuMax(const string& file) {
+    ifstream in(file);
+    string quota;
+    double period = 0;
+    if(!(in >> quota >> period) || quota == "max" || period <= 0) {
+        return 0;
+    }
+    return stod(quota) / period;
+}
+
+}
+
+double cgroupCpuLimit() {
+    string path = cgroupPath();
+    if(path.empty()) {
+        return 0;
+    }
+
+    /*
+    * 父cgroup的配额同样限制子cgroup，取整条路径上的最小值
+    */
+    const string root = "/sys/fs/cgroup";
+    double limit = 0;
+    for(;;) {
+        double current = readCpuMax(root + path + "/cpu.max");
+        if(current > 0 && (limit == 0 || current < limit)) {
+            limit = current;
+        }
+        if(path.empty() || path == "/") {
+            break;
+        }
+        size_t slash = path.find_last_of('/');
+        path = slash == string::npos ? "" : path.substr(0, slash);
+    }
+    return limit;
+}
+
+namespace {
+
+int computeAvailableCpus() {
+    int cpus = affinityCpuCount();
+    double limit = cgroupCpuLimit();
+    if(limit > 0) {
+        cpus = min(cpus, static_cast<int>(ceil(limit)));
+    }
+    return max(1, cpus);
+}
+
+/*
+* 第一次使用时读取，之后只在refreshAvailableCpus中更新
+*/
+atomic_int& cachedCpus() {
+    static atomic_int cpus(computeAvailableCpus());
+    return cpus;
+}
+
+}
+
+int availableCpus() {
+    return cachedCpus().load(memory_order_relaxed);
+}
+
+int refreshAvailableCpus() {
+    int cpus = computeAvailableCpus();
+    cachedCpus().store(cpus, memory_order_relaxed);
+    return cpus;
+}
+
+namespace {
+
+/*
+* 解析"48K"、"2048K"、"8M"这样的大小
+*/
+size_t parseCacheSize(const string& text) {
+    size_t pos = 0;
+    size_t value = stoul(text, &pos);
+    if(pos < text.size()) {
+        if(text[pos] == 'K') {
+            value <<= 10;
+        } else if(text[pos] == 'M') {
+            value <<= 20;
+        }
+    }
+    return value;
+}
+
+}
+
+size_t cacheSize(int level) {
+    static const size_t defaults[] = {32 << 10, 256 << 10, 8 << 20};
+    if(level < 1 || level > 3) {
+        return 0;
+    }
+
+    /*
+    * 只统计数据缓存和统一缓存，跳过指令缓存；只在第一次调用时读取
+    */
+    static const vector<size_t> sizes = []() {
+        vector<size_t> found(4, 0);
+        for(int index = 0; index < 16; index++) {
+            string dir = "/sys/devices/system/cpu/cpu0/cache/index" + to_string(index) + "/";
+            ifstream levelFile(dir + "level");
+            int cacheLevel = 0;
+            if(!(levelFile >> cacheLevel)) {
+                break;
+            }
+            ifstream typeFile(dir + "type");
+            ifstream sizeFile(dir + "size");
+            string type;
+            string size;
+            if(!(typeFile >> type) || !(sizeFile >> size) || type == "Instruction"
+                || cacheLevel < 1 || cacheLevel > 3) {
+                continue;
+            }
+            try {
+                found[cacheLevel] = parseCacheSize(size);
+            } catch(...) {
+            }
+        }
+        return found;
+    }();
+    return sizes[level] != 0 ? sizes[level] : defaults[level - 1];
+}
+
+CpuQuotaWatcher::CpuQuotaWatcher(function<void(int)> onChange, chrono::milliseconds interval)
+    :onChange_(move(onChange))
+     ,interval_(interval)
+     ,cpus_(availableCpus())
+     ,stopped_(false)
+     ,watcher_(&CpuQuotaWatcher::watch, this)
+{}
+
+CpuQuotaWatcher::CpuQuotaWatcher(ThreadPool& pool, chrono::milliseconds interval)
+    :CpuQuotaWatcher([&pool](int cpus) {
+        CpuBudget::global().setSlots(cpus);
+        pool.resize(cpus);
+    }, interval)
+{}
+
+CpuQuotaWatcher::~CpuQuotaWatcher() {
+    {
+        lock_guard<mutex> lock(watchMutex);
+        stopped_ = true;
+    }
+    stopCond.notify_all();
+    watcher_.join();
+}
+
+int CpuQuotaWatcher::getCpus() const {
+    lock_guard<mutex> lock(watchMutex);
+    return cpus_;
+}
+
+void CpuQuotaWatcher::watch() {
+    unique_lock<mutex> lock(watchMutex);
+    while(!stopCond.wait_for(lock, interval_, [&]()->bool { return stopped_; })) {
+        lock.unlock();
+        int cpus = refreshAvailableCpus();
+        lock.lock();
+        if(cpus == cpus_) {
+            continue;
+        }
+        cpus_ = cpus;
+
+        /*
+        * 回调可能调整线程池，不持有锁执行
+        */
+        lock.unlock();
+        onChange_(cpus);
+        lock.lock();
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef CPUQUOTA_H
+#define CPUQUOTA_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+class ThreadPool;
+
+/*
+* 当前进程可以使用的CPU数：sched_getaffinity允许的CPU数与cgroup v2的cpu.max配额向上取整后的较小值，至少为1
+* 在只分配了2个CPU配额的容器中，hardware_concurrency仍然返回宿主机的核数，用它决定线程数会导致严重的限流
+* 第一次调用时读取/proc和cgroup文件并缓存，之后只读取缓存，可以在热路径和持锁时调用；
+* 缓存由CpuQuotaWatcher或refreshAvailableCpus()更新
+*/
+int availableCpus();
+
+/*
+* 重新读取CPU亲和性和cgroup配额并更新availableCpus()的缓存，返回新的值
+*/
+int refreshAvailableCpus();
+
+/*
+* CPU亲和性掩码中的CPU数
+*/
+int affinityCpuCount();
+
+/*
+* cgroup v2 cpu.max限制的CPU数（quota / period），沿cgroup层级向上取最小值，没有限制时返回0
+*/
+double cgroupCpuLimit();
+
+/*
+* 数据缓存的大小（字节），level为1、2、3，从/sys/devices/system/cpu/cpu0/cache读取
+* 读取失败时返回常见的默认值：L1 32K，L2 256K，L3 8M
+*/
+size_t cacheSize(int level);
+
+/*
+* example:
+* ThreadPool pool;
+* pool.start();
+* CpuQuotaWatcher watcher(pool);
+*
+* 定期通过refreshAvailableCpus()重新计算并更新缓存，变化时调用回调；容器的CPU配额在运行时被调整后，线程池和全局CPU预算随之扩缩容
+* 析构时停止后台线程
+*/
+class CpuQuotaWatcher {
+public:
+    CpuQuotaWatcher(function<void(int)> onChange, chrono::milliseconds interval = chrono::seconds(5));
+
+    /*
+    * 配额变化时把pool和全局CPU预算的槽位数都调整为新的CPU数
+    */
+    CpuQuotaWatcher(ThreadPool& pool, chrono::milliseconds interval = chrono::seconds(5));
+    ~CpuQuotaWatcher();
+
+    CpuQuotaWatcher(const CpuQuotaWatcher&) = delete;
+    CpuQuotaWatcher& operator = (const CpuQuotaWatcher&) = delete;
+
+    /*
+    * 最近一次观察到的CPU数
+    */
+    int getCpus() const;
+
+private:
+    void watch();
+
+private:
+    function<void(int)> onChange_;
+    chrono::milliseconds interval_;
+    int cpus_;
+    bool stopped_;
+    mutable mutex watchMutex;
+    condition_variable stopCond;
+    thread watcher_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "dirwalker.hpp"
+#include "cpubudget.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+/*
+* getdents64返回的目录项格式，glibc没有提供这个结构体的定义
+*/
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*
+* 每个线程复用一块读取缓冲区，避免每个目录都分配一次
+*/
+char* threadBuffer(size_t size) {
+    thread_local vector<char> buffer;
+    if(buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+}
+
+DirectoryWalker::DirectoryWalker(ThreadPool& pool, int maxOpenDirs, size_t bufferSize)
+    :pool_(pool)
+     ,bufferSize_(bufferSize)
+     ,openDirs_(maxOpenDirs > 0 ? maxOpenDirs : 1)
+     ,pendingDirs_(0)
+     ,files_(0)
+     ,errors_(0)
+{}
+
+size_t DirectoryWalker::walk(const string& root, FileCallback onFile) {
+    onFile_ = move(onFile);
+    files_ = 0;
+    errors_ = 0;
+    done_.reset();
+
+    pendingDirs_.store(1, memory_order_relaxed);
+    expand(root);
+    {
+        CpuBudget::BlockingRegion region;
+        done_.wait();
+    }
+
+    onFile_ = nullptr;
+    return files_.load(memory_order_relaxed);
+}
+
+size_t DirectoryWalker::errors() const {
+    return errors_.load(memory_order_relaxed);
+}
+
+void DirectoryWalker::expand(string dir) {
+    vector<string> local;
+    local.push_back(move(dir));
+
+    while(!local.empty()) {
+        string current = move(local.back());
+        local.pop_back();
+
+        vector<string> subdirs;
+        readDirectory(current, subdirs);
+
+        /*
+        * 先登记所有子目录再完成当前目录，保证计数不会提前归零
+        */
+        pendingDirs_.fetch_add(subdirs.size(), memory_order_relaxed);
+        for(string& sub : subdirs) {
+            shared_ptr<string> path = make_shared<string>(move(sub));
+            if(!pool_.tryExecute([this, path]() { expand(move(*path)); })) {
+                local.push_back(move(*path));
+            }
+        }
+        finishDirectory();
+    }
+}
+
+void DirectoryWalker::readDirectory(const string& dir, vector<string>& subdirs) {
+    /*
+    * 打开的目录数达到上限时需要阻塞等待，等待期间归还CPU预算槽位
+    */
+    if(!openDirs_.tryWait()) {
+        CpuBudget::BlockingRegion region;
+        openDirs_.wait();
+    }
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        openDirs_.post();
+        errors_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    char* buffer = threadBuffer(bufferSize_);
+    string prefix = dir;
+    if(prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    for(;;) {
+        long bytes = syscall(SYS_getdents64, fd, buffer, bufferSize_);
+        if(bytes <= 0) {
+            if(bytes < 0) {
+                errors_.fetch_add(1, memory_order_relaxed);
+            }
+            break;
+        }
+
+        for(long offset = 0; offset < bytes;) {
+            LinuxDirent64* entry = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            /*
+            * 部分文件系统不填d_type，此时用fstatat补齐，不跟随符号链接
+            */
+            unsigned char type = entry->d_type;
+            if(type == DT_UNKNOWN) {
+                struct stat st;
+                if(fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = IFTODT(st.st_mode);
+                }
+            }
+
+            if(type == DT_DIR) {
+                subdirs.push_back(prefix + name);
+            } else {
+                onFile_(prefix + name, type);
+                files_.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+
+    close(fd);
+    openDirs_.post();
+}
+
+void DirectoryWalker::finishDirectory() {
+    if(pendingDirs_.fetch_sub(1, memory_order_acq_rel) == 1) {
+        done_.set();
+    }
+}
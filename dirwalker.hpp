@@ -0,0 +1,75 @@
+#ifndef DIRWALKER_H
+#define DIRWALKER_H
+
+#include "threadpool.hpp"
+#include <string>
+
+/*
+* example:
+* DirectoryWalker walker(pool);
+* atomic<size_t> bytes(0);
+* walker.walk("/data", [&](const string& path, unsigned char type) {
+*     if(type == DT_REG) {
+*         bytes += fileSize(path);
+*     }
+* });
+*
+* 并行递归遍历目录树：每展开一个目录就是线程池中的一个任务，
+* 空闲的工作线程从共享队列中取走任意一个待展开的目录，深浅不同的子树自然地分散到所有线程上。
+* 目录用getdents64批量读取，一次系统调用取回一整个缓冲区的目录项；
+* 同时打开的目录数由信号量限制，读完目录立即关闭，提交子目录时不持有文件描述符。
+* 不跟随符号链接，符号链接和其他非目录项都交给回调。
+*/
+class DirectoryWalker {
+public:
+    /*
+    * 回调参数是完整路径和d_type（DT_REG、DT_LNK等），会在多个工作线程中并发调用
+    */
+    using FileCallback = function<void(const string& path, unsigned char type)>;
+
+    DirectoryWalker(ThreadPool& pool, int maxOpenDirs = 64, size_t bufferSize = 64 * 1024);
+    ~DirectoryWalker() = default;
+
+    DirectoryWalker(const DirectoryWalker&) = delete;
+    DirectoryWalker& operator = (const DirectoryWalker&) = delete;
+
+    /*
+    * 遍历root下的所有文件，返回时所有回调都已经执行完毕，返回交给回调的文件数
+    * 调用线程展开根目录后等待其余目录完成，同一个DirectoryWalker不能同时执行两次walk
+    */
+    size_t walk(const string& root, FileCallback onFile);
+
+    /*
+    * 上一次walk中无法打开或读取的目录数
+    */
+    size_t errors() const;
+
+private:
+    /*
+    * 展开一个目录，子目录优先提交到线程池，队列已满时放入本地栈由当前线程继续展开
+    */
+    void expand(string dir);
+
+    /*
+    * 读取一个目录，文件交给回调，子目录追加到subdirs
+    */
+    void readDirectory(const string& dir, vector<string>& subdirs);
+
+    /*
+    * 一个目录展开完毕，最后一个目录完成时唤醒walk
+    */
+    void finishDirectory();
+
+private:
+    ThreadPool& pool_;
+    size_t bufferSize_;
+
+    Semaphore openDirs_;
+    atomic<size_t> pendingDirs_;
+    atomic<size_t> files_;
+    atomic<size_t> errors_;
+    Event done_;
+    FileCallback onFile_;
+};
+
+#endif
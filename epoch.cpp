@@ -0,0 +1,240 @@
+#include "epoch.hpp"
+#include <unordered_map>
+
+/*
+* 每retire多少个对象尝试回收一次
+*/
+const int EPOCH_COLLECT_INTERVAL = 64;
+
+/*
+* 存活的域，线程退出时据此判断域是否已经析构，避免访问已经释放的域
+* 故意不析构：已经离开线程池的线程可能在进程退出时仍在执行线程局部变量的析构
+*/
+static mutex& liveDomainsMutex() {
+    static mutex* m = new mutex();
+    return *m;
+}
+
+static unordered_map<uint64_t, EpochDomain*>& liveDomains() {
+    static unordered_map<uint64_t, EpochDomain*>* domains = new unordered_map<uint64_t, EpochDomain*>();
+    return *domains;
+}
+
+static atomic<uint64_t> nextDomainId{1};
+
+/*
+* 当前线程在各个域中的记录，线程退出时归还
+*/
+class EpochThreadRecords {
+public:
+    struct Entry {
+        EpochDomain* domain;
+        uint64_t id;
+        EpochDomain::Record* record;
+    };
+
+    ~EpochThreadRecords() {
+        lock_guard<mutex> lock(liveDomainsMutex());
+        for(Entry& entry : entries) {
+            auto it = liveDomains().find(entry.id);
+            if(it != liveDomains().end()) {
+                entry.domain->releaseRecord(entry.record);
+            }
+        }
+    }
+
+    /*
+    * 绝大多数线程只使用全局域，第一个元素就能命中
+    */
+    vector<Entry> entries;
+};
+
+static thread_local EpochThreadRecords threadRecords;
+
+EpochDomain::EpochDomain()
+    :globalEpoch_(0)
+     ,records_(nullptr)
+     ,id_(nextDomainId++)
+{
+    lock_guard<mutex> lock(liveDomainsMutex());
+    liveDomains().emplace(id_, this);
+}
+
+EpochDomain::~EpochDomain() {
+    {
+        lock_guard<mutex> lock(liveDomainsMutex());
+        liveDomains().erase(id_);
+    }
+
+    Record* record = records_.load();
+    while(record != nullptr) {
+        Record* next = record->next;
+        for(Retired& r : record->limbo) {
+            r.deleter(r.ptr);
+        }
+        delete record;
+        record = next;
+    }
+    for(Retired& r : orphans_) {
+        r.deleter(r.ptr);
+    }
+}
+
+EpochDomain& EpochDomain::global() {
+    /*
+    * 故意不析构：工作线程是分离的，进程退出时可能仍在访问
+    */
+    static EpochDomain* domain = new EpochDomain();
+    return *domain;
+}
+
+EpochDomain::Record* EpochDomain::localRecord() {
+    for(EpochThreadRecords::Entry& entry : threadRecords.entries) {
+        if(entry.id == id_) {
+            return entry.record;
+        }
+    }
+    Record* record = acquireRecord();
+    threadRecords.entries.push_back(EpochThreadRecords::Entry{this, id_, record});
+    return record;
+}
+
+EpochDomain::Record* EpochDomain::acquireRecord() {
+    /*
+    * 优先复用已退出线程留下的记录
+    */
+    for(Record* record = records_.load(memory_order_acquire); record != nullptr; record = record->next) {
+        bool expected = false;
+        if(!record->inUse.load(memory_order_relaxed)
+            && record->inUse.compare_exchange_strong(expected, true, memory_order_acquire)) {
+            return record;
+        }
+    }
+
+    Record* record = new Record();
+    record->epoch.store(INACTIVE, memory_order_relaxed);
+    record->inUse.store(true, memory_order_relaxed);
+    record->nesting = 0;
+    record->retireCount = 0;
+    record->next = records_.load(memory_order_relaxed);
+    while(!records_.compare_exchange_weak(record->next, record,
+                                          memory_order_release, memory_order_relaxed)) {}
+    return record;
+}
+
+void EpochDomain::releaseRecord(Record* record) {
+    record->epoch.store(INACTIVE, memory_order_release);
+    record->nesting = 0;
+    {
+        lock_guard<mutex> lock(orphanMutex_);
+        orphans_.insert(orphans_.end(), record->limbo.begin(), record->limbo.end());
+    }
+    record->limbo.clear();
+    record->inUse.store(false, memory_order_release);
+}
+
+void EpochDomain::enter() {
+    Record* record = localRecord();
+    if(record->nesting++ > 0) {
+        return;
+    }
+
+    /*
+    * 公布epoch之后的读取不能被重排到公布之前
+    */
+    record->epoch.store(globalEpoch_.load(memory_order_relaxed), memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void EpochDomain::exit() {
+    Record* record = localRecord();
+    if(--record->nesting > 0) {
+        return;
+    }
+    record->epoch.store(INACTIVE, memory_order_release);
+}
+
+void EpochDomain::quiescent() {
+    Record* record = localRecord();
+    if(record->nesting > 0) {
+        return;
+    }
+    uint64_t epoch = globalEpoch_.load(memory_order_relaxed);
+    if(record->epoch.load(memory_order_relaxed) != epoch) {
+        record->epoch.store(epoch, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+void EpochDomain::offline() {
+    Record* record = localRecord();
+    if(record->nesting > 0) {
+        return;
+    }
+    record->epoch.store(INACTIVE, memory_order_release);
+}
+
+void EpochDomain::enterTask() {
+    Record* record = localRecord();
+    if(record->nesting++ > 0) {
+        return;
+    }
+    uint64_t epoch = globalEpoch_.load(memory_order_relaxed);
+    if(record->epoch.load(memory_order_relaxed) != epoch) {
+        record->epoch.store(epoch, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+void EpochDomain::exitTask() {
+    localRecord()->nesting--;
+}
+
+void EpochDomain::retire(void* p, void (*deleter)(void*)) {
+    Record* record = localRecord();
+    record->limbo.push_back(Retired{p, deleter, globalEpoch_.load(memory_order_acquire)});
+    if(++record->retireCount >= EPOCH_COLLECT_INTERVAL) {
+        record->retireCount = 0;
+        collect();
+    }
+}
+
+bool EpochDomain::tryAdvance() {
+    uint64_t epoch = globalEpoch_.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    for(Record* record = records_.load(memory_order_acquire); record != nullptr; record = record->next) {
+        uint64_t local = record->epoch.load(memory_order_acquire);
+        if(local != INACTIVE && local != epoch) {
+            return false;
+        }
+    }
+    return globalEpoch_.compare_exchange_strong(epoch, epoch + 1, memory_order_acq_rel);
+}
+
+void EpochDomain::reclaim(vector<Retired>& limbo, uint64_t epoch) {
+    size_t kept = 0;
+    for(size_t i = 0; i < limbo.size(); i++) {
+        if(limbo[i].epoch + 2 <= epoch) {
+            limbo[i].deleter(limbo[i].ptr);
+        } else {
+            limbo[kept++] = limbo[i];
+        }
+    }
+    limbo.resize(kept);
+}
+
+void EpochDomain::collect() {
+    tryAdvance();
+    uint64_t epoch = globalEpoch_.load(memory_order_acquire);
+
+    reclaim(localRecord()->limbo, epoch);
+
+    unique_lock<mutex> lock(orphanMutex_, try_to_lock);
+    if(lock.owns_lock() && !orphans_.empty()) {
+        reclaim(orphans_, epoch);
+    }
+}
+
+uint64_t EpochDomain::currentEpoch() const {
+    return globalEpoch_.load(memory_order_acquire);
+}
@@ -0,0 +1,164 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/*
+* example:
+* // 线程池之外的线程读取无锁结构之前进入临界区
+* {
+*     EpochGuard guard;
+*     Node* node = head.load();
+*     ...
+* }
+* // 摘下节点后延迟释放
+* EpochDomain::global().retire(oldNode);
+*
+* 基于epoch的内存回收（EBR）
+* 无锁容器摘下的节点不能立即释放，因为其他线程可能还持有它的指针。
+* 每个参与的线程在访问共享结构期间公布自己观察到的全局epoch，
+* 所有活跃线程都已经观察到当前epoch之后全局epoch才能前进，
+* 在epoch e中被retire的对象，等全局epoch前进到e+2时就不会再有线程引用它，可以安全释放。
+*
+* 线程池的工作线程在threadFunc每一轮循环开始时调用quiescent()公布epoch，
+* 执行任务时通过enterTask()/exitTask()持有一层嵌套，任务代码使用无锁容器时不需要额外加EpochGuard，
+* 任务中嵌套的EpochGuard析构时也不会让工作线程提前离开临界区；
+* 工作线程睡眠前调用offline()，避免空闲线程阻止epoch前进。
+* 线程池之外的线程通过enter()/exit()或EpochGuard参与。
+*/
+class EpochDomain {
+public:
+    EpochDomain();
+
+    /*
+    * 析构时释放所有尚未回收的对象，调用者需要保证此时没有线程仍在访问
+    */
+    ~EpochDomain();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator = (const EpochDomain&) = delete;
+
+    /*
+    * 线程池使用的全局域
+    */
+    static EpochDomain& global();
+
+    /*
+    * 进入/退出临界区，可以嵌套
+    */
+    void enter();
+    void exit();
+
+    /*
+    * 工作线程公布自己已经不再持有任何旧指针，以当前全局epoch重新进入临界区
+    * 嵌套在enter()之内调用时不做任何事
+    */
+    void quiescent();
+
+    /*
+    * 工作线程即将长时间阻塞，退出临界区
+    */
+    void offline();
+
+    /*
+    * 工作线程执行任务期间的一层嵌套，任务中的enter()/exit()、quiescent()、offline()都不会离开临界区
+    * 已经通过quiescent()以当前epoch处于临界区时不需要再次公布；exitTask之后仍保持公布的epoch
+    */
+    void enterTask();
+    void exitTask();
+
+    /*
+    * 延迟释放p，直到所有可能引用它的线程都离开临界区
+    */
+    void retire(void* p, void (*deleter)(void*));
+
+    template<typename T>
+    void retire(T* p) {
+        retire(static_cast<void*>(p), [](void* q) { delete static_cast<T*>(q); });
+    }
+
+    /*
+    * 尝试推进全局epoch并释放当前线程可以安全回收的对象
+    */
+    void collect();
+
+    uint64_t currentEpoch() const;
+
+private:
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    /*
+    * 每个线程在一个域中的记录，线程退出后记录被标记为空闲，供新线程复用
+    * 按缓存行对齐，推进epoch时扫描各线程的epoch不会与其他线程的写入产生伪共享
+    */
+    struct alignas(64) Record {
+        atomic<uint64_t> epoch;
+        atomic_bool inUse;
+        int nesting;
+        int retireCount;
+        vector<Retired> limbo;
+        Record* next;
+    };
+
+    friend class EpochThreadRecords;
+
+    Record* localRecord();
+    Record* acquireRecord();
+
+    /*
+    * 线程退出时调用，未回收的对象移交给域
+    */
+    void releaseRecord(Record* record);
+
+    bool tryAdvance();
+    void reclaim(vector<Retired>& limbo, uint64_t epoch);
+
+private:
+    static const uint64_t INACTIVE = UINT64_MAX;
+
+    atomic<uint64_t> globalEpoch_;
+
+    /*
+    * 只增不减的无锁链表，线程第一次参与时加入
+    */
+    atomic<Record*> records_;
+
+    /*
+    * 已退出线程遗留的待回收对象
+    */
+    mutex orphanMutex_;
+    vector<Retired> orphans_;
+
+    uint64_t id_;
+};
+
+/*
+* RAII方式进入和退出临界区
+*/
+class EpochGuard {
+public:
+    EpochGuard(EpochDomain& domain = EpochDomain::global()) : domain_(domain) {
+        domain_.enter();
+    }
+
+    ~EpochGuard() {
+        domain_.exit();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator = (const EpochGuard&) = delete;
+
+private:
+    EpochDomain& domain_;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "hedged.hpp"
+#include <algorithm>
+#include <thread>
+
+/*
+* 延迟队列，在后台线程中到期执行回调，所有对冲任务共享一个线程
+*/
+class DelayQueue {
+public:
+    static DelayQueue& instance() {
+        static DelayQueue queue;
+        return queue;
+    }
+
+    void schedule(chrono::steady_clock::time_point deadline, function<void()> func) {
+        unique_lock<mutex> lock(queueMutex);
+        bool earliest = timers.empty() || deadline < timers.top().deadline;
+        timers.push(Timer{deadline, seq++, move(func)});
+        if(earliest) {
+            queueCond.notify_one();
+        }
+    }
+
+    ~DelayQueue() {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            stopped = true;
+            queueCond.notify_one();
+        }
+        worker.join();
+    }
+
+private:
+    struct Timer {
+        chrono::steady_clock::time_point deadline;
+        uint64_t seq;
+        function<void()> func;
+
+        /*
+        * priority_queue是大顶堆，反过来比较得到最早到期的定时器
+        */
+        bool operator < (const Timer& other) const {
+            if(deadline != other.deadline) {
+                return deadline > other.deadline;
+            }
+            return seq > other.seq;
+        }
+    };
+
+    DelayQueue() : seq(0), stopped(false) {
+        worker = thread(&DelayQueue::loop, this);
+    }
+
+    void loop() {
+        unique_lock<mutex> lock(queueMutex);
+        while(!stopped) {
+            if(timers.empty()) {
+                queueCond.wait(lock);
+                continue;
+            }
+            auto deadline = timers.top().deadline;
+            if(chrono::steady_clock::now() < deadline) {
+                queueCond.wait_until(lock, deadline);
+                continue;
+            }
+            function<void()> func = move(const_cast<Timer&>(timers.top()).func);
+            timers.pop();
+
+            lock.unlock();
+            func();
+            lock.lock();
+        }
+    }
+
+private:
+    priority_queue<Timer> timers;
+    uint64_t seq;
+    bool stopped;
+    mutex queueMutex;
+    condition_variable queueCond;
+    thread worker;
+};
+
+/*
+* 用户拿到的Result绑定在HedgeGate上，先完成的一次执行把结果交给它
+*/
+class HedgeGate : public Task {
+public:
+    HedgeGate(function<Any()> task, shared_ptr<LatencyTracker> tracker)
+        : task_(move(task)), tracker_(move(tracker)), done_(false)
+    {}
+
+    Any run() {
+        return move(value_);
+    }
+
+    /*
+    * 提交一次执行，调用前需持有gateMutex
+    * wait为false时队列已满立即返回false，不阻塞调用线程
+    * 提交失败时丢弃执行任务，否则它捕获的self与attempts_形成引用环，整个HedgeGate永远不会释放
+    */
+    bool launch(ThreadPool& pool, shared_ptr<HedgeGate> self, int index, bool wait) {
+        auto start = chrono::steady_clock::now();
+        attempts_[index] = make_shared<FuncTask>([self, index, start]() {
+            self->attempt(index, start);
+        });
+        bool submitted = wait ? pool.execute(attempts_[index]) : pool.tryExecute(attempts_[index]);
+        if(!submitted) {
+            attempts_[index].reset();
+        }
+        return submitted;
+    }
+
+    bool isDone() const {
+        return done_.load(memory_order_acquire);
+    }
+
+    /*
+    * 提交第一次执行时持有该锁直到Result构造完成，保证结果写入时Result已经绑定
+    */
+    mutex gateMutex;
+
+private:
+    void attempt(int index, chrono::steady_clock::time_point start) {
+        if(isDone()) {
+            return;
+        }
+        Any value = task_();
+        if(done_.exchange(true, memory_order_acq_rel)) {
+            return;
+        }
+
+        if(tracker_ != nullptr) {
+            tracker_->record(chrono::steady_clock::now() - start);
+        }
+
+        unique_lock<mutex> lock(gateMutex);
+        shared_ptr<Task> loser = attempts_[1 - index];
+        if(loser != nullptr) {
+            loser->cancel();
+        }
+
+        /*
+        * 执行任务持有HedgeGate，完成后断开引用环
+        */
+        attempts_[0].reset();
+        attempts_[1].reset();
+
+        value_ = move(value);
+        exec();
+    }
+
+private:
+    function<Any()> task_;
+    shared_ptr<LatencyTracker> tracker_;
+    atomic_bool done_;
+    shared_ptr<Task> attempts_[2];
+    Any value_;
+};
+
+static Result launchHedged(ThreadPool& pool,
+                           function<Any()> task,
+                           chrono::microseconds delay,
+                           shared_ptr<LatencyTracker> tracker) {
+    shared_ptr<HedgeGate> gate = make_shared<HedgeGate>(move(task), move(tracker));
+    unique_lock<mutex> lock(gate->gateMutex);
+
+    if(!gate->launch(pool, gate, 0, true)) {
+        return Result(gate, false);
+    }
+
+    /*
+    * 定时器线程由所有对冲请求共享，不能等待队列空位；队列已满说明线程池已经过载，放弃这次对冲
+    */
+    DelayQueue::instance().schedule(chrono::steady_clock::now() + delay, [&pool, gate]() {
+        unique_lock<mutex> lock(gate->gateMutex);
+        if(!gate->isDone()) {
+            gate->launch(pool, gate, 1, false);
+        }
+    });
+
+    return Result(gate, true);
+}
+
+Result submitHedged(ThreadPool& pool, function<Any()> task, chrono::microseconds delay) {
+    return launchHedged(pool, move(task), delay, nullptr);
+}
+
+LatencyTracker::LatencyTracker(size_t window)
+    :samples(window > 0 ? window : 1, 0)
+     ,nextIndex(0)
+     ,sampleCount(0)
+{}
+
+void LatencyTracker::record(chrono::nanoseconds latency) {
+    lock_guard<mutex> lock(trackerMutex);
+    samples[nextIndex] = latency.count();
+    nextIndex = (nextIndex + 1) % samples.size();
+    if(sampleCount < samples.size()) {
+        sampleCount++;
+    }
+}
+
+chrono::nanoseconds LatencyTracker::percentile(double p) const {
+    vector<int64_t> copy;
+    {
+        lock_guard<mutex> lock(trackerMutex);
+        copy.assign(samples.begin(), samples.begin() + sampleCount);
+    }
+    if(copy.empty()) {
+        return chrono::nanoseconds(0);
+    }
+
+    size_t k = min(copy.size() - 1, static_cast<size_t>(p * copy.size()));
+    nth_element(copy.begin(), copy.begin() + k, copy.end());
+    return chrono::nanoseconds(copy[k]);
+}
+
+size_t LatencyTracker::count() const {
+    lock_guard<mutex> lock(trackerMutex);
+    return sampleCount;
+}
+
+/*
+* 样本少于该数量时分位数不可靠，使用初始延迟
+*/
+const size_t MIN_HEDGE_SAMPLES = 32;
+
+Hedger::Hedger(ThreadPool& pool, double percentile, chrono::microseconds initialDelay, size_t window)
+    :pool_(pool)
+     ,percentile_(percentile)
+     ,initialDelay_(initialDelay)
+     ,tracker_(make_shared<LatencyTracker>(window))
+{}
+
+Result Hedger::submitHedged(function<Any()> task) {
+    return launchHedged(pool_, move(task), currentDelay(), tracker_);
+}
+
+Result Hedger::submitHedged(function<Any()> task, chrono::microseconds delay) {
+    return launchHedged(pool_, move(task), delay, tracker_);
+}
+
+chrono::microseconds Hedger::currentDelay() const {
+    if(tracker_->count() < MIN_HEDGE_SAMPLES) {
+        return initialDelay_;
+    }
+    return chrono::duration_cast<chrono::microseconds>(tracker_->percentile(percentile_));
+}
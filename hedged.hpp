@@ -0,0 +1,78 @@
+#ifndef HEDGED_H
+#define HEDGED_H
+
+#include "threadpool.hpp"
+#include <chrono>
+#include <cstdint>
+
+/*
+* 记录最近window次执行的耗时，用于估计延迟分位数
+*/
+class LatencyTracker {
+public:
+    LatencyTracker(size_t window = 1024);
+    ~LatencyTracker() = default;
+
+    void record(chrono::nanoseconds latency);
+
+    /*
+    * 返回最近样本的p分位数（0 < p < 1），没有样本时返回0
+    */
+    chrono::nanoseconds percentile(double p) const;
+
+    size_t count() const;
+
+private:
+    mutable mutex trackerMutex;
+    vector<int64_t> samples;
+    size_t nextIndex;
+    size_t sampleCount;
+};
+
+/*
+* 对冲执行：先提交一次执行，若delay后仍未完成则再提交一次相同的执行，
+* 先完成的结果写入Result，另一次执行被取消（排队中的直接跳过，执行中的可以通过this_task::is_cancelled()退出）。
+* task必须是幂等的，可能被执行两次。线程池队列已满时返回无效的Result。
+*/
+Result submitHedged(ThreadPool& pool, function<Any()> task, chrono::microseconds delay);
+
+/*
+* example:
+* Hedger hedger(pool, 0.95);
+* Result res = hedger.submitHedged([]() -> Any { return readColdPage(); });
+* int value = res.get().cast_<int>();
+*
+* 根据历史耗时自动选择对冲延迟：延迟取最近执行耗时的percentile分位数，
+* 样本不足时使用initialDelay
+*/
+class Hedger {
+public:
+    Hedger(ThreadPool& pool,
+           double percentile = 0.95,
+           chrono::microseconds initialDelay = chrono::microseconds(1000),
+           size_t window = 1024);
+    ~Hedger() = default;
+
+    Hedger(const Hedger&) = delete;
+    Hedger& operator = (const Hedger&) = delete;
+
+    Result submitHedged(function<Any()> task);
+    Result submitHedged(function<Any()> task, chrono::microseconds delay);
+
+    /*
+    * 当前使用的对冲延迟
+    */
+    chrono::microseconds currentDelay() const;
+
+private:
+    ThreadPool& pool_;
+    double percentile_;
+    chrono::microseconds initialDelay_;
+
+    /*
+    * 执行中的任务可能比Hedger活得更久，所以用shared_ptr共享
+    */
+    shared_ptr<LatencyTracker> tracker_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "mappedfile.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+    :data_(nullptr)
+     ,size_(0)
+{}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if(size_ == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /*
+    * 映射建立后文件描述符就不再需要了
+    */
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        size_ = 0;
+        return false;
+    }
+    data_ = static_cast<const char*>(addr);
+
+    /*
+    * 顺序访问：内核加大预读窗口，并尽早回收已经读过的页
+    */
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::close() {
+    if(data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+string_view MappedFile::view() const {
+    return string_view(data_, size_);
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) const {
+    if(data_ == nullptr || offset >= size_) {
+        return;
+    }
+
+    /*
+    * madvise要求起始地址按页对齐
+    */
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = offset & ~(pageSize - 1);
+    size_t end = min(offset + length, size_);
+    madvise(const_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+}
+
+vector<string_view> splitChunks(string_view data, size_t chunkSize, string_view delimiter) {
+    vector<string_view> chunks;
+    if(chunkSize == 0) {
+        chunkSize = 1;
+    }
+
+    size_t begin = 0;
+    while(begin < data.size()) {
+        size_t target = begin + chunkSize;
+        size_t end;
+        if(target >= data.size() || delimiter.empty()) {
+            end = min(target, data.size());
+        } else {
+            /*
+            * 从目标位置往后找到分隔符，块在分隔符之后结束；从target - (delimiter.size() - 1)开始找，
+            * 避免多字节分隔符恰好跨过目标位置
+            */
+            size_t from = target - min(target - begin, delimiter.size() - 1);
+            size_t pos = data.find(delimiter, from);
+            end = pos == string_view::npos ? data.size() : pos + delimiter.size();
+        }
+        chunks.push_back(data.substr(begin, end - begin));
+        begin = end;
+    }
+    return chunks;
+}
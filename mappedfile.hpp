@@ -0,0 +1,139 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "orderedcollector.hpp"
+#include "parallel.hpp"
+#include <string>
+#include <string_view>
+
+/*
+* 只读内存映射文件，析构时解除映射
+*/
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    /*
+    * 映射整个文件并提示内核顺序读取，失败返回false
+    */
+    bool open(const string& path);
+    void close();
+
+    string_view view() const;
+    size_t size() const;
+
+    /*
+    * 提示内核预读[offset, offset + length)，用于在处理当前块时预读下一块
+    */
+    void willNeed(size_t offset, size_t length) const;
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+/*
+* 把data切成大约chunkSize字节的块，每个块都在分隔符之后结束（最后一块除外），记录不会被切断
+*/
+vector<string_view> splitChunks(string_view data, size_t chunkSize, string_view delimiter = "\n");
+
+/*
+* example:
+* // 按块顺序返回每个块的结果
+* vector<long> lines = mapChunks<long>(pool, "access.log", 8 << 20, [](string_view chunk) {
+*     return count(chunk.begin(), chunk.end(), '\n');
+* });
+*
+* 并行处理内存映射文件：文件被切成按记录对齐的块，每个块作为一个任务在线程池中执行，
+* 任务通过string_view直接访问映射的内存，没有拷贝。处理第i块时预读第i+1块。
+*/
+template<typename R>
+vector<R> mapChunks(ThreadPool& pool, const string& path, size_t chunkSize,
+                    function<R(string_view)> func, string_view delimiter = "\n") {
+    MappedFile file;
+    if(!file.open(path)) {
+        return {};
+    }
+    vector<string_view> chunks = splitChunks(file.view(), chunkSize, delimiter);
+    vector<R> results(chunks.size());
+    const char* base = file.view().data();
+
+    parallel_for(pool, chunks.size(), [&](size_t i) {
+        if(i + 1 < chunks.size()) {
+            file.willNeed(chunks[i + 1].data() - base, chunks[i + 1].size());
+        }
+        results[i] = func(chunks[i]);
+    });
+    return results;
+}
+
+/*
+* 流式有序输出：块的结果按文件顺序交给sink，sink在调用线程中执行，
+* 前缀完整就立即输出，最多缓存window个乱序完成的结果
+*/
+template<typename R>
+void forEachChunkOrdered(ThreadPool& pool, const string& path, size_t chunkSize,
+                         function<R(string_view)> func, function<void(R&)> sink,
+                         size_t window = 64, string_view delimiter = "\n") {
+    MappedFile file;
+    if(!file.open(path)) {
+        return;
+    }
+    vector<string_view> chunks = splitChunks(file.view(), chunkSize, delimiter);
+    const char* base = file.view().data();
+
+    OrderedCollector<R> collector(pool, window);
+    size_t submitted = 0;
+    size_t consumed = 0;
+    R value;
+
+    /*
+    * 调用线程交替提交和消费，窗口满时先消费，避免submit阻塞在自己身上
+    */
+    while(consumed < chunks.size()) {
+        while(submitted < chunks.size() && submitted - consumed < window) {
+            size_t i = submitted++;
+            collector.submit([&, i]() {
+                if(i + 1 < chunks.size()) {
+                    file.willNeed(chunks[i + 1].data() - base, chunks[i + 1].size());
+                }
+                return func(chunks[i]);
+            });
+        }
+        if(collector.next(value)) {
+            sink(value);
+            consumed++;
+        }
+    }
+}
+
+/*
+* 流式无序输出：块完成后立即交给sink，sink在工作线程中串行调用（持有锁），调用顺序为完成顺序
+*/
+template<typename R>
+void forEachChunkUnordered(ThreadPool& pool, const string& path, size_t chunkSize,
+                           function<R(string_view)> func, function<void(R&)> sink,
+                           string_view delimiter = "\n") {
+    MappedFile file;
+    if(!file.open(path)) {
+        return;
+    }
+    vector<string_view> chunks = splitChunks(file.view(), chunkSize, delimiter);
+    const char* base = file.view().data();
+    mutex sinkMutex;
+
+    parallel_for(pool, chunks.size(), [&](size_t i) {
+        if(i + 1 < chunks.size()) {
+            file.willNeed(chunks[i + 1].data() - base, chunks[i + 1].size());
+        }
+        R value = func(chunks[i]);
+        lock_guard<mutex> lock(sinkMutex);
+        sink(value);
+    });
+}
+
+#endif
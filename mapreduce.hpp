@@ -0,0 +1,367 @@
+#ifndef MAPREDUCE_H
+#define MAPREDUCE_H
+
+#include "parallel.hpp"
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+
+/*
+* 溢写文件的序列化方式，默认支持可平凡复制的类型和string
+* 其他类型需要特化Serializer并提供write/read/size；write返回是否完整写入，read返回是否读到完整的值
+* 不能序列化的类型不会溢写，内存预算对它们无效
+*/
+template<typename T, typename Enable = void>
+struct Serializer {
+    static constexpr bool supported = false;
+};
+
+template<typename T>
+struct Serializer<T, typename enable_if<is_trivially_copyable<T>::value>::type> {
+    static constexpr bool supported = true;
+
+    static bool write(FILE* file, const T& value) {
+        return fwrite(&value, sizeof(T), 1, file) == 1;
+    }
+
+    static bool read(FILE* file, T& value) {
+        return fread(&value, sizeof(T), 1, file) == 1;
+    }
+
+    static size_t size(const T&) {
+        return sizeof(T);
+    }
+};
+
+template<>
+struct Serializer<string> {
+    static constexpr bool supported = true;
+
+    static bool write(FILE* file, const string& value) {
+        uint64_t length = value.size();
+        return fwrite(&length, sizeof(length), 1, file) == 1
+            && fwrite(value.data(), 1, value.size(), file) == value.size();
+    }
+
+    static bool read(FILE* file, string& value) {
+        uint64_t length;
+        if(fread(&length, sizeof(length), 1, file) != 1) {
+            return false;
+        }
+        value.resize(length);
+        return fread(&value[0], 1, length, file) == length;
+    }
+
+    static size_t size(const string& value) {
+        return sizeof(string) + value.size();
+    }
+};
+
+/*
+* example:
+* MapReduceJob<string, string, long, long> job;
+* job.setMapper([](const string& line, MapReduceJob<string, string, long, long>::Emitter& out) {
+*     for(const string& word : split(line)) {
+*         out.emit(word, 1);
+*     }
+* });
+* job.setCombiner([](long& acc, const long& v) { acc += v; });
+* job.setReducer([](const string& word, vector<long>& counts) {
+*     return accumulate(counts.begin(), counts.end(), 0L);
+* });
+* vector<pair<string, long>> result = job.run(pool, lines);
+*
+* 运行在线程池上的MapReduce：
+* 1. 输入按splitSize切成若干map任务，每个map任务把输出按key的哈希写入自己的分区缓冲区，
+*    分区缓冲区是[map任务][分区]的矩阵，shuffle阶段不需要任何全局锁；
+* 2. 设置了combiner时，每个map任务先在本地按key合并，减少shuffle的数据量；
+* 3. 每个分区一个reduce任务，收集所有map任务在该分区的输出，按key分组后调用reducer；
+* 4. 设置了内存预算时，分区在内存中的数据量超过预算后，写满的map缓冲区溢写到本地磁盘，reduce时再读回。
+*    预算只约束map和shuffle阶段：reduce任务按key分组时会把该分区溢写的数据全部读回内存，
+*    所以单个分区的数据仍然需要能放进内存，数据量大时应增加分区数。
+*/
+template<typename In, typename K, typename V, typename R, typename Hash = hash<K>>
+class MapReduceJob {
+public:
+    class Emitter;
+
+    using Mapper = function<void(const In&, Emitter&)>;
+    using Combiner = function<void(V&, const V&)>;
+    using Reducer = function<R(const K&, vector<V>&)>;
+
+    MapReduceJob()
+        : partitionCount_(availableCpus())
+        , splitSize_(1024)
+        , memoryBudget_(0)
+        , spillDir_("/tmp")
+    {}
+
+    MapReduceJob(const MapReduceJob&) = delete;
+    MapReduceJob& operator = (const MapReduceJob&) = delete;
+
+    void setMapper(Mapper mapper) { mapper_ = move(mapper); }
+    void setCombiner(Combiner combiner) { combiner_ = move(combiner); }
+    void setReducer(Reducer reducer) { reducer_ = move(reducer); }
+
+    /*
+    * reduce分区数量
+    */
+    void setPartitions(size_t partitions) { partitionCount_ = partitions > 0 ? partitions : 1; }
+
+    /*
+    * 每个map任务处理的输入数量
+    */
+    void setSplitSize(size_t splitSize) { splitSize_ = splitSize > 0 ? splitSize : 1; }
+
+    /*
+    * shuffle缓冲区的总内存预算（字节），0表示不限制、不溢写
+    */
+    void setMemoryBudget(size_t bytes) { memoryBudget_ = bytes; }
+
+    void setSpillDir(string dir) { spillDir_ = move(dir); }
+
+    /*
+    * 执行任务，返回所有分区的reduce结果，同一分区内的结果顺序不确定
+    */
+    vector<pair<K, R>> run(ThreadPool& pool, const vector<In>& input) {
+        size_t mapCount = (input.size() + splitSize_ - 1) / splitSize_;
+        partitionBytes_.reset(new atomic<size_t>[partitionCount_]);
+        for(size_t p = 0; p < partitionCount_; p++) {
+            partitionBytes_[p] = 0;
+        }
+
+        vector<unique_ptr<Emitter>> emitters;
+        for(size_t m = 0; m < mapCount; m++) {
+            emitters.emplace_back(unique_ptr<Emitter>(new Emitter(*this, m)));
+        }
+
+        parallel_for(pool, mapCount, [&](size_t m) {
+            size_t begin = m * splitSize_;
+            size_t end = min(begin + splitSize_, input.size());
+            Emitter& emitter = *emitters[m];
+            for(size_t i = begin; i < end; i++) {
+                mapper_(input[i], emitter);
+            }
+            emitter.finish();
+        });
+
+        vector<vector<pair<K, R>>> outputs(partitionCount_);
+        parallel_for(pool, partitionCount_, [&](size_t p) {
+            unordered_map<K, vector<V>, Hash> groups;
+            for(unique_ptr<Emitter>& emitter : emitters) {
+                emitter->drainPartition(p, groups);
+            }
+            for(auto& kv : groups) {
+                outputs[p].emplace_back(kv.first, reducer_(kv.first, kv.second));
+            }
+        });
+
+        vector<pair<K, R>> result;
+        for(vector<pair<K, R>>& output : outputs) {
+            move(output.begin(), output.end(), back_inserter(result));
+        }
+        return result;
+    }
+
+    /*
+    * map函数的输出接口，每个map任务一个，只被执行该任务的线程访问
+    */
+    class Emitter {
+    public:
+        void emit(const K& key, V value) {
+            size_t p = job_.partitionOf(key);
+            Partition& partition = partitions_[p];
+
+            if(job_.combiner_) {
+                auto result = partition.combined.emplace(key, value);
+                if(!result.second) {
+                    job_.combiner_(result.first->second, value);
+                    return;
+                }
+                account(p, entryBytes(key, value));
+            } else {
+                /*
+                * value移入缓冲区之前估算大小
+                */
+                size_t bytes = entryBytes(key, value);
+                partition.pairs.emplace_back(key, move(value));
+                account(p, bytes);
+            }
+        }
+
+        ~Emitter() {
+            for(Partition& partition : partitions_) {
+                if(!partition.spillPath.empty()) {
+                    unlink(partition.spillPath.c_str());
+                }
+            }
+        }
+
+    private:
+        friend class MapReduceJob;
+
+        struct Partition {
+            vector<pair<K, V>> pairs;
+            unordered_map<K, V, Hash> combined;
+            size_t bytes = 0;
+            string spillPath;
+
+            /*
+            * 溢写文件中完整写入的字节数，读回时只读这么多，失败的写入留下的残缺记录被忽略
+            */
+            long spilledBytes = 0;
+
+            /*
+            * 溢写失败（磁盘已满、无法创建文件等）后不再溢写，数据留在内存中
+            */
+            bool spillFailed = false;
+        };
+
+        Emitter(MapReduceJob& job, size_t index)
+            : job_(job), index_(index), partitions_(job.partitionCount_)
+        {}
+
+        /*
+        * 一条输出在缓冲区中的估算大小，不限制内存或者不能序列化时为0
+        */
+        size_t entryBytes(const K& key, const V& value) const {
+            if constexpr(Serializer<K>::supported && Serializer<V>::supported) {
+                if(job_.memoryBudget_ != 0) {
+                    return Serializer<K>::size(key) + Serializer<V>::size(value);
+                }
+            }
+            return 0;
+        }
+
+        /*
+        * 记录缓冲区占用，分区总量超过预算时溢写当前map任务的该分区缓冲区
+        */
+        void account(size_t p, size_t bytes) {
+            if constexpr(Serializer<K>::supported && Serializer<V>::supported) {
+                if(bytes == 0) {
+                    return;
+                }
+                partitions_[p].bytes += bytes;
+                size_t total = job_.partitionBytes_[p].fetch_add(bytes, memory_order_relaxed) + bytes;
+                if(total > job_.memoryBudget_ / job_.partitionCount_) {
+                    spill(p);
+                }
+            }
+        }
+
+        /*
+        * map任务结束时，带combiner的分区转存成pairs
+        */
+        void finish() {
+            if(!job_.combiner_) {
+                return;
+            }
+            for(Partition& partition : partitions_) {
+                for(auto& kv : partition.combined) {
+                    partition.pairs.emplace_back(kv.first, move(kv.second));
+                }
+                partition.combined.clear();
+            }
+        }
+
+        /*
+        * 溢写失败时保留内存中的数据并停止该分区的溢写，文件中残缺的记录在spilledBytes之后，读回时被忽略
+        */
+        void spill(size_t p) {
+            if constexpr(Serializer<K>::supported && Serializer<V>::supported) {
+                Partition& partition = partitions_[p];
+                if(partition.spillFailed || (partition.pairs.empty() && partition.combined.empty())) {
+                    return;
+                }
+                if(partition.spillPath.empty()) {
+                    partition.spillPath = job_.spillDir_ + "/mapreduce-" + to_string(getpid()) + "-"
+                        + to_string(reinterpret_cast<uintptr_t>(&job_)) + "-m" + to_string(index_)
+                        + "-p" + to_string(p) + ".spill";
+                }
+                FILE* file = fopen(partition.spillPath.c_str(), "ab");
+                if(file == nullptr) {
+                    partition.spillFailed = true;
+                    return;
+                }
+
+                bool ok = true;
+                auto write = [&](const K& key, const V& value) {
+                    ok = ok && Serializer<K>::write(file, key) && Serializer<V>::write(file, value);
+                };
+                for(auto& kv : partition.pairs) {
+                    write(kv.first, kv.second);
+                }
+                for(auto& kv : partition.combined) {
+                    write(kv.first, kv.second);
+                }
+                ok = ok && fflush(file) == 0 && !ferror(file) && fseek(file, 0, SEEK_END) == 0;
+                long end = ok ? ftell(file) : -1;
+                if(fclose(file) != 0 || end < 0) {
+                    partition.spillFailed = true;
+                    return;
+                }
+                partition.spilledBytes = end;
+
+                partition.pairs.clear();
+                partition.combined.clear();
+                job_.partitionBytes_[p].fetch_sub(partition.bytes, memory_order_relaxed);
+                partition.bytes = 0;
+            }
+        }
+
+        /*
+        * reduce阶段调用，读回溢写的数据并合并内存中的数据，读回的数据不受内存预算约束
+        */
+        void drainPartition(size_t p, unordered_map<K, vector<V>, Hash>& groups) {
+            Partition& partition = partitions_[p];
+            if constexpr(Serializer<K>::supported && Serializer<V>::supported) {
+                if(partition.spilledBytes > 0) {
+                    FILE* file = fopen(partition.spillPath.c_str(), "rb");
+                    if(file != nullptr) {
+                        K key;
+                        V value;
+                        while(ftell(file) < partition.spilledBytes
+                            && Serializer<K>::read(file, key) && Serializer<V>::read(file, value)) {
+                            groups[key].push_back(move(value));
+                        }
+                        fclose(file);
+                    }
+                }
+            }
+            for(auto& kv : partition.pairs) {
+                groups[kv.first].push_back(move(kv.second));
+            }
+            partition.pairs.clear();
+        }
+
+    private:
+        MapReduceJob& job_;
+        size_t index_;
+        vector<Partition> partitions_;
+    };
+
+private:
+    size_t partitionOf(const K& key) const {
+        uint64_t h = hasher_(key);
+        return static_cast<size_t>(((h ^ (h >> 32)) * 0x9E3779B97F4A7C15ULL) >> 32) % partitionCount_;
+    }
+
+private:
+    Mapper mapper_;
+    Combiner combiner_;
+    Reducer reducer_;
+    size_t partitionCount_;
+    size_t splitSize_;
+    size_t memoryBudget_;
+    string spillDir_;
+    Hash hasher_;
+
+    /*
+    * 每个分区在内存中的数据量，各map任务无锁累加
+    */
+    unique_ptr<atomic<size_t>[]> partitionBytes_;
+};
+
+#endif
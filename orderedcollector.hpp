@@ -0,0 +1,162 @@
+#ifndef ORDEREDCOLLECTOR_H
+#define ORDEREDCOLLECTOR_H
+
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include <cstdint>
+#include <optional>
+
+/*
+* example:
+* OrderedCollector<int> collector(pool, 16);
+* thread producer([&]() {
+*     for(int i = 0; i < 65536; i += 4096) {
+*         collector.submit([=]() { return sum(i, i + 4096); });
+*     }
+*     collector.close();
+* });
+* int value;
+* while(collector.next(value)) {...}
+*
+* 按提交顺序输出结果：乱序完成的结果暂存在大小为window的重排窗口里，
+* 一旦前缀完整就立即交给消费者，慢的队首任务不会阻塞已经完成的后续结果被放入窗口。
+* 窗口写满时submit阻塞，以此限制生产者的速度和缓存的结果数量。
+* 只允许一个消费者调用next/tryNext。
+*/
+template<typename T>
+class OrderedCollector {
+public:
+    OrderedCollector(ThreadPool& pool, size_t window = 64)
+        : pool_(pool)
+        , window_(window > 0 ? window : 1)
+        , slots_(window_)
+        , submitted_(0)
+        , completed_(0)
+        , yielded_(0)
+        , closed_(false)
+    {}
+
+    /*
+    * 任务持有this，析构前必须等待所有已提交的任务执行完毕
+    */
+    ~OrderedCollector() {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        allDone_.wait(lock, [&]()->bool { return completed_ == submitted_; });
+    }
+
+    OrderedCollector(const OrderedCollector&) = delete;
+    OrderedCollector& operator = (const OrderedCollector&) = delete;
+
+    /*
+    * 提交一个任务，序号按提交顺序递增，窗口已满时阻塞直到消费者取走队首结果
+    * 已经close返回false
+    */
+    bool submit(function<T()> func) {
+        uint64_t seq;
+        {
+            CpuBudget::BlockingRegion region;
+            unique_lock<mutex> lock(mutex_);
+            notFull_.wait(lock, [&]()->bool { return closed_ || submitted_ - yielded_ < window_; });
+            if(closed_) {
+                return false;
+            }
+            seq = submitted_++;
+        }
+
+        function<void()> job = [this, seq, func = move(func)]() { complete(seq, func()); };
+
+        /*
+        * 队列已满时不等待空位，直接在当前线程执行，序号一旦分配就必须产生结果，否则后面的结果永远无法输出
+        */
+        shared_ptr<FuncTask> task = make_shared<FuncTask>(move(job));
+        if(!pool_.tryExecute(task)) {
+            task->exec();
+        }
+        return true;
+    }
+
+    /*
+    * 不再提交新任务，消费者取完剩余结果后next返回false
+    */
+    void close() {
+        unique_lock<mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        ready_.notify_all();
+    }
+
+    /*
+    * 阻塞等待下一个按序的结果，关闭且全部取完后返回false
+    */
+    bool next(T& out) {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        ready_.wait(lock, [&]()->bool {
+            return slots_[yielded_ % window_].has_value() || (closed_ && yielded_ == submitted_);
+        });
+        return take(out);
+    }
+
+    /*
+    * 非阻塞版本，队首结果还没完成时返回false
+    */
+    bool tryNext(T& out) {
+        unique_lock<mutex> lock(mutex_);
+        return take(out);
+    }
+
+private:
+    void complete(uint64_t seq, T value) {
+        unique_lock<mutex> lock(mutex_);
+        slots_[seq % window_] = move(value);
+        completed_++;
+
+        /*
+        * 只有补齐前缀的结果才需要唤醒消费者
+        */
+        if(seq == yielded_) {
+            ready_.notify_all();
+        }
+        if(completed_ == submitted_) {
+            allDone_.notify_all();
+        }
+    }
+
+    /*
+    * 调用前需持有mutex_
+    */
+    bool take(T& out) {
+        optional<T>& slot = slots_[yielded_ % window_];
+        if(!slot.has_value()) {
+            return false;
+        }
+        out = move(*slot);
+        slot.reset();
+        yielded_++;
+        notFull_.notify_one();
+        return true;
+    }
+
+private:
+    ThreadPool& pool_;
+    size_t window_;
+
+    /*
+    * 重排窗口，序号为seq的结果放在slots_[seq % window_]
+    * submitted_ - yielded_ <= window_保证窗口内的槽位不会被覆盖
+    */
+    vector<optional<T>> slots_;
+
+    uint64_t submitted_;
+    uint64_t completed_;
+    uint64_t yielded_;
+    bool closed_;
+
+    mutex mutex_;
+    condition_variable notFull_;
+    condition_variable ready_;
+    condition_variable allDone_;
+};
+
+#endif
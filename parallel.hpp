@@ -0,0 +1,294 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include "cpuquota.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+/*
+* 分块策略
+* grain是每次领取的连续下标数（多维版本中是连续的块数），越大调度开销越小，但负载越不均衡
+* maxTasks是最多同时参与的任务数，包括调用线程自己
+*/
+struct ChunkPolicy {
+    size_t grain = 1;
+    size_t maxTasks = availableCpus();
+};
+
+/*
+* parallel_for的共享状态
+* 辅助任务持有它的shared_ptr，调用者返回之后才被工作线程取出的辅助任务也不会访问已经销毁的栈
+*/
+struct ParallelForState {
+    /*
+    * gate的最高位表示调用者已经关闭，低位是已经开始执行、尚未结束的辅助任务数
+    */
+    static const uint32_t CLOSED = 1u << 31;
+
+    ParallelForState(size_t count, size_t chunk, const function<void(size_t)>& fn)
+        :n(count)
+         ,grain(chunk)
+         ,body(fn)
+         ,next(0)
+         ,gate(0)
+    {}
+
+    /*
+    * 循环领取接下来的grain个下标，直到全部领完
+    */
+    void drain() {
+        for(size_t begin = next.fetch_add(grain, memory_order_relaxed); begin < n;
+            begin = next.fetch_add(grain, memory_order_relaxed)) {
+            size_t end = min(begin + grain, n);
+            for(size_t i = begin; i < end; i++) {
+                body(i);
+            }
+        }
+    }
+
+    /*
+    * 辅助任务先登记再参与执行；调用者已经关闭时直接返回，不再访问body
+    */
+    void help() {
+        uint32_t state = gate.load(memory_order_acquire);
+        do {
+            if((state & CLOSED) != 0) {
+                return;
+            }
+        } while(!gate.compare_exchange_weak(state, state + 1, memory_order_acq_rel, memory_order_acquire));
+
+        drain();
+        if(gate.fetch_sub(1, memory_order_acq_rel) == (CLOSED | 1)) {
+            finished.set();
+        }
+    }
+
+    /*
+    * 调用者领完下标后关闭，只等待已经登记的辅助任务
+    */
+    void close() {
+        if(gate.fetch_or(CLOSED, memory_order_acq_rel) != 0) {
+            CpuBudget::BlockingRegion region;
+            finished.wait();
+        }
+    }
+
+    size_t n;
+    size_t grain;
+    const function<void(size_t)>& body;
+    atomic<size_t> next;
+    atomic<uint32_t> gate;
+    Event finished;
+};
+
+/*
+* example:
+* parallel_for(pool, partitions.size(), [&](size_t i) {
+*     process(partitions[i]);
+* });
+*
+* 把[0, n)中的下标分给线程池执行，返回时所有下标都已经处理完
+* 最多提交policy.maxTasks - 1个辅助任务，每个任务（包括调用线程自己）循环领取接下来的policy.grain个下标。
+* 调用线程也参与执行，领完所有下标后只等待已经开始执行的辅助任务，还在队列中的辅助任务之后被取出时直接返回，
+* 所以在工作线程中调用（包括所有工作线程同时调用）或者线程池繁忙时也能完成，不会因为等待辅助任务而死锁。
+*/
+inline void parallel_for(ThreadPool& pool, size_t n, const function<void(size_t)>& body,
+                         ChunkPolicy policy) {
+    if(n == 0) {
+        return;
+    }
+    size_t grain = max<size_t>(policy.grain, 1);
+    size_t maxTasks = max<size_t>(policy.maxTasks, 1);
+    size_t chunks = (n + grain - 1) / grain;
+    size_t helpers = min(chunks, maxTasks) - 1;
+
+    shared_ptr<ParallelForState> state = make_shared<ParallelForState>(n, grain, body);
+    for(size_t h = 0; h < helpers; h++) {
+        pool.tryExecute([state]() { state->help(); });
+    }
+
+    state->drain();
+    state->close();
+}
+
+inline void parallel_for(ThreadPool& pool, size_t n, const function<void(size_t)>& body,
+                         size_t maxTasks = availableCpus()) {
+    ChunkPolicy policy;
+    policy.maxTasks = maxTasks;
+    parallel_for(pool, n, body, policy);
+}
+
+/*
+* 二维、三维迭代空间中的一个块，区间都是左闭右开
+*/
+struct Block2D {
+    size_t rowBegin;
+    size_t rowEnd;
+    size_t colBegin;
+    size_t colEnd;
+};
+
+struct Block3D {
+    size_t depthBegin;
+    size_t depthEnd;
+    size_t rowBegin;
+    size_t rowEnd;
+    size_t colBegin;
+    size_t colEnd;
+};
+
+/*
+* 块的大小
+*/
+struct Tile2D {
+    size_t rows;
+    size_t cols;
+};
+
+struct Tile3D {
+    size_t depth;
+    size_t rows;
+    size_t cols;
+};
+
+/*
+* 根据L2缓存大小选择块的大小：一个块的数据占L2的一半，为输入输出等其他数据留出空间；
+* 列数（最内层维度）取缓存行包含元素数的整数倍，块的每一行都从整缓存行开始（假设数组按缓存行对齐）
+*/
+inline Tile2D autoTile2D(size_t elementSize = sizeof(double)) {
+    size_t elements = max<size_t>(cacheSize(2) / 2 / max<size_t>(elementSize, 1), 1);
+    size_t line = max<size_t>(64 / max<size_t>(elementSize, 1), 1);
+    size_t side = static_cast<size_t>(sqrt(static_cast<double>(elements)));
+    size_t cols = max(line, side / line * line);
+    return Tile2D{max<size_t>(elements / cols, 1), cols};
+}
+
+inline Tile3D autoTile3D(size_t elementSize = sizeof(double)) {
+    size_t elements = max<size_t>(cacheSize(2) / 2 / max<size_t>(elementSize, 1), 1);
+    size_t line = max<size_t>(64 / max<size_t>(elementSize, 1), 1);
+    size_t side = static_cast<size_t>(cbrt(static_cast<double>(elements)));
+    size_t cols = max(line, side / line * line);
+    size_t rows = max<size_t>(static_cast<size_t>(sqrt(static_cast<double>(elements / cols))), 1);
+    return Tile3D{max<size_t>(elements / cols / rows, 1), rows, cols};
+}
+
+/*
+* Morton编码（Z序）：把各维坐标的二进制位交错排列，编码相邻的块在各个维度上也相邻
+*/
+inline uint64_t mortonSpread2(uint64_t v) {
+    v &= 0xffffffff;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+inline uint64_t mortonSpread3(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffULL;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+/*
+* example:
+* parallel_for_2d(pool, height, width, [&](const Block2D& b) {
+*     for(size_t y = b.rowBegin; y < b.rowEnd; y++) {
+*         for(size_t x = b.colBegin; x < b.colEnd; x++) {
+*             out[y * width + x] = blur(in, y, x);
+*         }
+*     }
+* }, autoTile2D(sizeof(float)));
+*
+* 把rows x cols的迭代空间切成块，按Morton顺序排列后交给parallel_for，
+* 同一个任务每次领取policy.grain个连续的块，它们在内存中也彼此相邻，缓存中的数据可以被后续的块复用
+*/
+inline void parallel_for_2d(ThreadPool& pool, size_t rows, size_t cols,
+                            const function<void(const Block2D&)>& body,
+                            Tile2D tile = autoTile2D(), ChunkPolicy policy = ChunkPolicy()) {
+    if(rows == 0 || cols == 0) {
+        return;
+    }
+    tile.rows = max<size_t>(tile.rows, 1);
+    tile.cols = max<size_t>(tile.cols, 1);
+    size_t tilesY = (rows + tile.rows - 1) / tile.rows;
+    size_t tilesX = (cols + tile.cols - 1) / tile.cols;
+
+    /*
+    * 块数不是2的幂时Morton编码不连续，按编码排序即可跳过不存在的块
+    */
+    vector<pair<uint64_t, size_t>> order;
+    order.reserve(tilesY * tilesX);
+    for(size_t ty = 0; ty < tilesY; ty++) {
+        for(size_t tx = 0; tx < tilesX; tx++) {
+            order.emplace_back(mortonSpread2(ty) << 1 | mortonSpread2(tx), ty * tilesX + tx);
+        }
+    }
+    sort(order.begin(), order.end());
+
+    parallel_for(pool, order.size(), [&](size_t i) {
+        size_t ty = order[i].second / tilesX;
+        size_t tx = order[i].second % tilesX;
+        Block2D block;
+        block.rowBegin = ty * tile.rows;
+        block.rowEnd = min(block.rowBegin + tile.rows, rows);
+        block.colBegin = tx * tile.cols;
+        block.colEnd = min(block.colBegin + tile.cols, cols);
+        body(block);
+    }, policy);
+}
+
+/*
+* 三维版本，块按(depth, row, col)三个坐标的Morton顺序执行
+*/
+inline void parallel_for_3d(ThreadPool& pool, size_t depth, size_t rows, size_t cols,
+                            const function<void(const Block3D&)>& body,
+                            Tile3D tile = autoTile3D(), ChunkPolicy policy = ChunkPolicy()) {
+    if(depth == 0 || rows == 0 || cols == 0) {
+        return;
+    }
+    tile.depth = max<size_t>(tile.depth, 1);
+    tile.rows = max<size_t>(tile.rows, 1);
+    tile.cols = max<size_t>(tile.cols, 1);
+    size_t tilesZ = (depth + tile.depth - 1) / tile.depth;
+    size_t tilesY = (rows + tile.rows - 1) / tile.rows;
+    size_t tilesX = (cols + tile.cols - 1) / tile.cols;
+
+    vector<pair<uint64_t, size_t>> order;
+    order.reserve(tilesZ * tilesY * tilesX);
+    for(size_t tz = 0; tz < tilesZ; tz++) {
+        for(size_t ty = 0; ty < tilesY; ty++) {
+            for(size_t tx = 0; tx < tilesX; tx++) {
+                uint64_t code = mortonSpread3(tz) << 2 | mortonSpread3(ty) << 1 | mortonSpread3(tx);
+                order.emplace_back(code, (tz * tilesY + ty) * tilesX + tx);
+            }
+        }
+    }
+    sort(order.begin(), order.end());
+
+    parallel_for(pool, order.size(), [&](size_t i) {
+        size_t index = order[i].second;
+        size_t tx = index % tilesX;
+        size_t ty = index / tilesX % tilesY;
+        size_t tz = index / tilesX / tilesY;
+        Block3D block;
+        block.depthBegin = tz * tile.depth;
+        block.depthEnd = min(block.depthBegin + tile.depth, depth);
+        block.rowBegin = ty * tile.rows;
+        block.rowEnd = min(block.rowBegin + tile.rows, rows);
+        block.colBegin = tx * tile.cols;
+        block.colEnd = min(block.colBegin + tile.cols, cols);
+        body(block);
+    }, policy);
+}
+
+#endif
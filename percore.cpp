@@ -0,0 +1,270 @@
+#include "percore.hpp"
+#include <pthread.h>
+#include <sched.h>
+
+/*
+* 工作线程所属的线程池与核编号
+*/
+static thread_local ThreadPerCorePool* currentPool = nullptr;
+static thread_local int currentCore = -1;
+
+/*
+* 空闲时先自旋检查若干轮再睡眠，自旋期间不进入内核
+*/
+const int CORE_SPIN_ROUNDS = 256;
+
+ThreadPerCorePool::ThreadPerCorePool(size_t ringCapacity)
+    :ringCapacity_(ringCapacity)
+     ,stopping_(false)
+     ,isRunning_(false)
+{}
+
+ThreadPerCorePool::~ThreadPerCorePool() {
+    stop();
+}
+
+void ThreadPerCorePool::start(int cores, bool pin) {
+    if(isRunning_.load()) {
+        return;
+    }
+    if(cores <= 0) {
+        cores = availableCpus();
+    }
+
+    /*
+    * 上一次运行的工作线程都已经退出，通道中也没有剩余任务
+    */
+    cores_.clear();
+
+    /*
+    * 每个核有cores条核间通道加一条外部通道
+    */
+    for(int i = 0; i < cores; i++) {
+        unique_ptr<Core> core = make_unique<Core>();
+        for(int j = 0; j <= cores; j++) {
+            core->inbound.emplace_back(make_unique<SpscRing<Func>>(ringCapacity_));
+        }
+        core->submitting = 0;
+        core->sleeping = false;
+        core->wakeSeq = 0;
+        cores_.emplace_back(move(core));
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    vector<int> cpus;
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    stopping_ = false;
+    isRunning_.store(true, memory_order_seq_cst);
+    for(int i = 0; i < cores; i++) {
+        cores_[i]->worker = thread(&ThreadPerCorePool::coreFunc, this, i);
+        if(pin && !cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()], &set);
+            pthread_setaffinity_np(cores_[i]->worker.native_handle(), sizeof(set), &set);
+        }
+    }
+}
+
+void ThreadPerCorePool::stop() {
+    if(!isRunning_.exchange(false, memory_order_seq_cst)) {
+        return;
+    }
+
+    /*
+    * 与提交者"先登记再检查isRunning_"配对：要么提交者看到已经停止，要么这里看到它的登记
+    * 池外提交在externalMutex内检查并入队，加锁一次就等到了进行中的池外提交
+    */
+    atomic_thread_fence(memory_order_seq_cst);
+    for(unique_ptr<Core>& core : cores_) {
+        while(core->submitting.load(memory_order_acquire) > 0) {
+            this_thread::yield();
+        }
+        lock_guard<mutex> lock(core->externalMutex);
+    }
+
+    /*
+    * 此时不会再有任务进入通道，各核在所有通道为空后才检查stopping_并退出
+    * cores_保留到下一次start或析构，晚到的池外提交者仍然可以安全地访问它
+    */
+    stopping_.store(true, memory_order_seq_cst);
+    for(unique_ptr<Core>& core : cores_) {
+        core->wakeSeq.fetch_add(1, memory_order_seq_cst);
+        core->wakeSeq.notify_one();
+    }
+    for(unique_ptr<Core>& core : cores_) {
+        core->worker.join();
+    }
+}
+
+int ThreadPerCorePool::coreCount() const {
+    return static_cast<int>(cores_.size());
+}
+
+bool ThreadPerCorePool::trySubmitTo(int core, Func& func) {
+    if(core < 0 || core >= coreCount()) {
+        return false;
+    }
+
+    if(currentPool != this) {
+        Core& target = *cores_[core];
+        lock_guard<mutex> lock(target.externalMutex);
+        return isRunning_.load(memory_order_acquire) && pushTo(core, func);
+    }
+
+    /*
+    * 工作线程只在自己的计数上登记，快速路径上不写其他核共享的变量
+    */
+    Core& self = *cores_[currentCore];
+    self.submitting.store(self.submitting.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    bool pushed = isRunning_.load(memory_order_relaxed) && pushTo(core, func);
+    self.submitting.store(self.submitting.load(memory_order_relaxed) - 1, memory_order_release);
+    return pushed;
+}
+
+bool ThreadPerCorePool::pushTo(int core, Func& func) {
+    Core& target = *cores_[core];
+
+    /*
+    * 本核提交给自己，直接放入本地队列
+    */
+    if(currentPool == this && currentCore == core) {
+        target.local.emplace_back(move(func));
+        return true;
+    }
+
+    SpscRing<Func>& ring = currentPool == this ? *target.inbound[currentCore] : *target.inbound.back();
+    if(!ring.push(func)) {
+        return false;
+    }
+    wake(target);
+    return true;
+}
+
+bool ThreadPerCorePool::submitTo(int core, Func func) {
+    if(core < 0 || core >= coreCount()) {
+        return false;
+    }
+
+    /*
+    * 池外线程每次重试都在externalMutex内重新检查运行状态
+    */
+    if(currentPool != this) {
+        while(!trySubmitTo(core, func)) {
+            if(!isRunning_.load(memory_order_acquire)) {
+                return false;
+            }
+            this_thread::yield();
+        }
+        return true;
+    }
+
+    /*
+    * 整个等待过程都保持登记，stop会等到这里看到isRunning_为false后放弃
+    * 通道已满时继续消费发往本核的通道和本地队列，避免两个核互相等待对方腾出通道
+    */
+    Core& self = *cores_[currentCore];
+    self.submitting.store(self.submitting.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    bool pushed = false;
+    while(isRunning_.load(memory_order_relaxed) && !(pushed = pushTo(core, func))) {
+        if(!runOnce(self)) {
+            this_thread::yield();
+        }
+    }
+    self.submitting.store(self.submitting.load(memory_order_relaxed) - 1, memory_order_release);
+    return pushed;
+}
+
+void ThreadPerCorePool::wake(Core& core) {
+    /*
+    * 入队只是对tail_的release写入，读取sleeping之前需要StoreLoad屏障，
+    * 与核"先写sleeping再检查通道"之间的屏障配对，双方至少有一方看到对方的写入
+    */
+    atomic_thread_fence(memory_order_seq_cst);
+    if(core.sleeping.load(memory_order_relaxed)
+        && core.sleeping.exchange(false, memory_order_seq_cst)) {
+        core.wakeSeq.fetch_add(1, memory_order_seq_cst);
+        core.wakeSeq.notify_one();
+    }
+}
+
+bool ThreadPerCorePool::runOnce(Core& core) {
+    bool worked = false;
+    Func func;
+    for(unique_ptr<SpscRing<Func>>& ring : core.inbound) {
+        while(ring->pop(func)) {
+            core.local.emplace_back(move(func));
+        }
+    }
+    while(!core.local.empty()) {
+        Func next = move(core.local.front());
+        core.local.pop_front();
+        next();
+        worked = true;
+    }
+    return worked;
+}
+
+void ThreadPerCorePool::coreFunc(int id) {
+    currentPool = this;
+    currentCore = id;
+    Core& core = *cores_[id];
+
+    for(;;) {
+        if(runOnce(core)) {
+            continue;
+        }
+
+        bool worked = false;
+        for(int i = 0; i < CORE_SPIN_ROUNDS && !worked; i++) {
+            worked = runOnce(core);
+        }
+        if(worked) {
+            continue;
+        }
+
+        /*
+        * 先标记睡眠再检查一次通道，与生产者的"先入队再检查sleeping"配对，不会丢失唤醒
+        */
+        uint32_t seq = core.wakeSeq.load(memory_order_seq_cst);
+        core.sleeping.store(true, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool pending = false;
+        for(unique_ptr<SpscRing<Func>>& ring : core.inbound) {
+            if(!ring->empty()) {
+                pending = true;
+                break;
+            }
+        }
+        if(pending) {
+            core.sleeping.store(false, memory_order_relaxed);
+            continue;
+        }
+        if(stopping_.load(memory_order_seq_cst)) {
+            core.sleeping.store(false, memory_order_relaxed);
+            return;
+        }
+        core.wakeSeq.wait(seq, memory_order_seq_cst);
+        core.sleeping.store(false, memory_order_relaxed);
+    }
+}
+
+int this_core::id() {
+    return currentCore;
+}
+
+bool this_core::submitTo(int core, function<void()> func) {
+    if(currentPool == nullptr) {
+        return false;
+    }
+    return currentPool->submitTo(core, move(func));
+}
@@ -0,0 +1,148 @@
+#ifndef PERCORE_H
+#define PERCORE_H
+
+#include "spscring.hpp"
+#include "cpuquota.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/*
+* example:
+* ThreadPerCorePool cores;
+* cores.start(4);
+* cores.submitTo(1, []() {
+*     // 在1号核上执行，可以无锁访问1号核自己的数据
+*     this_core::submitTo(2, []() {...});
+* });
+*
+* 每核一线程、无共享模式（类似Seastar）：
+* 每个工作线程绑定到一个CPU，只执行自己队列中的任务，没有共享的任务队列、锁和原子计数器。
+* 核与核之间通过专用的SPSC环形队列通信，第i核发往第j核的任务只走inbound[j][i]这一条通道。
+* 池外线程提交时必须指定目标核，外部线程之间通过一把只在生产者侧使用的锁串行化，工作线程侧仍然无锁。
+*/
+class ThreadPerCorePool {
+public:
+    using Func = function<void()>;
+
+    ThreadPerCorePool(size_t ringCapacity = 1024);
+
+    /*
+    * 析构时停止所有核，已经提交的任务会被执行完
+    */
+    ~ThreadPerCorePool();
+
+    ThreadPerCorePool(const ThreadPerCorePool&) = delete;
+    ThreadPerCorePool& operator = (const ThreadPerCorePool&) = delete;
+
+    /*
+    * 启动cores个工作线程，pin为true时依次绑定到affinity mask中的CPU上
+    * cores为0时使用availableCpus()；重新启动时释放上一次运行留下的通道，不能与提交并发调用
+    */
+    void start(int cores = 0, bool pin = true);
+
+    /*
+    * 停止并等待所有工作线程退出
+    * 先拒绝新的提交（包括核之间的提交），等正在进行的提交返回后再让各核执行完通道中剩余的任务并退出
+    * 停止后通道保留到下一次start或析构，晚到的提交者只会看到已经停止而返回false
+    * 不能与start并发调用
+    */
+    void stop();
+
+    int coreCount() const;
+
+    /*
+    * 向指定的核提交任务，通道已满时自旋等待；未启动或已停止（包括等待期间停止）返回false
+    * 工作线程等待期间继续消费发往自己的通道和本地队列，两个核互相向对方已满的通道提交时不会卡死
+    */
+    bool submitTo(int core, Func func);
+
+    /*
+    * 非阻塞版本，通道已满返回false
+    */
+    bool trySubmitTo(int core, Func& func);
+
+private:
+    struct Core;
+
+    void coreFunc(int id);
+
+    /*
+    * 把所有通道中的任务搬到本地队列后执行，返回是否执行了任务
+    */
+    bool runOnce(Core& core);
+
+    /*
+    * 把任务放入目标核的通道，工作线程调用前需已在自己的submitting中登记，池外线程需持有目标核的externalMutex
+    */
+    bool pushTo(int core, Func& func);
+
+    /*
+    * 有新任务时唤醒正在睡眠的核，核没有睡眠时只读一次sleeping，不写共享变量
+    */
+    void wake(Core& core);
+
+private:
+    struct Core {
+        /*
+        * 只由本核访问的本地队列，本核给自己提交的任务直接放在这里
+        */
+        deque<Func> local;
+
+        /*
+        * inbound[i]是第i核发往本核的通道，最后一个是池外线程共用的通道
+        */
+        vector<unique_ptr<SpscRing<Func>>> inbound;
+
+        /*
+        * 串行化池外的生产者；池外提交在持有它时检查运行状态，stop加锁一次即可等到进行中的池外提交结束
+        */
+        mutex externalMutex;
+
+        /*
+        * 本核作为生产者正在进行的提交数，只由本核写入，stop等它归零；不与其他核共享缓存行
+        */
+        alignas(64) atomic_int submitting;
+
+        alignas(64) atomic_bool sleeping;
+        atomic<uint32_t> wakeSeq;
+
+        thread worker;
+    };
+
+    size_t ringCapacity_;
+    vector<unique_ptr<Core>> cores_;
+
+    /*
+    * 只在核空闲准备睡眠时检查，stop确认没有正在进行的提交后才设置
+    */
+    atomic_bool stopping_;
+
+    /*
+    * 是否接受提交：工作线程先在自己的submitting中登记再检查，池外线程在externalMutex内检查；
+    * stop先清除它，再等各核的登记归零并依次获取各核的externalMutex
+    */
+    atomic_bool isRunning_;
+};
+
+/*
+* 在ThreadPerCorePool的工作线程中访问当前核
+*/
+namespace this_core {
+    /*
+    * 当前核的编号，不在工作线程中时返回-1
+    */
+    int id();
+
+    /*
+    * 从当前核向目标核提交任务，不在工作线程中时返回false
+    */
+    bool submitTo(int core, function<void()> func);
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+* futex系统调用的封装，只在确实需要睡眠或唤醒时才进入内核
+* PRIVATE版本只在进程内使用，内核不需要处理跨进程的共享内存映射
+*/
+inline void futexWait(atomic<int32_t>& word, int32_t expected) {
+    static_assert(sizeof(atomic<int32_t>) == sizeof(int32_t), "futex word must be 32 bits");
+    syscall(SYS_futex, reinterpret_cast<int32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futexWake(atomic<int32_t>& word, int32_t count) {
+    syscall(SYS_futex, reinterpret_cast<int32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/*
+* 睡眠前自旋检查的次数，短暂的等待不进入内核
+* 单核机器上自旋只会占用需要唤醒我们的那个线程的时间片，所以不自旋
+*/
+inline int spinCount() {
+    static const int count = thread::hardware_concurrency() > 1 ? 256 : 0;
+    return count;
+}
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+* 计数信号量
+* count_大于0表示可用的资源数，小于0表示等待者的数量；
+* post只在count_为负（确实有等待者）时才写wakeups_并调用futexWake，
+* wait在资源充足时只有一次原子操作，并且睡眠前先自旋一段时间。
+* 每次post只唤醒与资源数相同数量的等待者，不会像notify_all那样惊醒所有等待者去争抢一个资源。
+*/
+class Semaphore {
+public:
+    Semaphore(int resource = 0) : count_(resource), wakeups_(0) {}
+    ~Semaphore() = default;
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator = (const Semaphore&) = delete;
+
+    bool tryWait() {
+        int32_t count = count_.load(memory_order_relaxed);
+        while(count > 0) {
+            if(count_.compare_exchange_weak(count, count - 1,
+                                            memory_order_acquire, memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wait() {
+        for(int i = 0; i < spinCount(); i++) {
+            if(tryWait()) {
+                return;
+            }
+            cpuRelax();
+        }
+        if(count_.fetch_sub(1, memory_order_acquire) > 0) {
+            return;
+        }
+        waitSlow();
+    }
+
+    void post(int n = 1) {
+        int32_t old = count_.fetch_add(n, memory_order_release);
+        int32_t toWake = old < 0 ? (-old < n ? -old : n) : 0;
+        if(toWake > 0) {
+            wakeups_.fetch_add(toWake, memory_order_release);
+            futexWake(wakeups_, toWake);
+        }
+    }
+
+private:
+    /*
+    * 已经登记为等待者，等待post发放的唤醒名额
+    */
+    void waitSlow() {
+        for(;;) {
+            int32_t wakeups = wakeups_.load(memory_order_acquire);
+            while(wakeups > 0) {
+                if(wakeups_.compare_exchange_weak(wakeups, wakeups - 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+                    return;
+                }
+            }
+            futexWait(wakeups_, 0);
+        }
+    }
+
+private:
+    atomic<int32_t> count_;
+    atomic<int32_t> wakeups_;
+};
+
+/*
+* 手动复位事件：set之后所有wait立即返回，直到reset
+* state_为0未触发，1已触发，2未触发且有等待者；只有存在等待者时set才会进入内核
+*/
+class Event {
+public:
+    Event(bool signaled = false) : state_(signaled ? SIGNALED : UNSIGNALED) {}
+
+    Event(const Event&) = delete;
+    Event& operator = (const Event&) = delete;
+
+    void set() {
+        if(state_.exchange(SIGNALED, memory_order_release) == WAITING) {
+            futexWake(state_, INT_MAX);
+        }
+    }
+
+    void reset() {
+        int32_t expected = SIGNALED;
+        state_.compare_exchange_strong(expected, UNSIGNALED, memory_order_relaxed);
+    }
+
+    bool isSet() const {
+        return state_.load(memory_order_acquire) == SIGNALED;
+    }
+
+    void wait() {
+        for(int i = 0; i < spinCount(); i++) {
+            if(isSet()) {
+                return;
+            }
+            cpuRelax();
+        }
+        for(;;) {
+            int32_t state = state_.load(memory_order_acquire);
+            if(state == SIGNALED) {
+                return;
+            }
+            if(state == UNSIGNALED
+                && !state_.compare_exchange_weak(state, WAITING, memory_order_acquire)) {
+                continue;
+            }
+            futexWait(state_, WAITING);
+        }
+    }
+
+private:
+    enum : int32_t {
+        UNSIGNALED = 0,
+        SIGNALED = 1,
+        WAITING = 2
+    };
+
+    atomic<int32_t> state_;
+};
+
+/*
+* 一次性门闩：计数减到0后所有wait返回
+* 只有计数归零且有等待者时countDown才进入内核
+*/
+class Latch {
+public:
+    Latch(int count) : count_(count), waiters_(0) {}
+
+    Latch(const Latch&) = delete;
+    Latch& operator = (const Latch&) = delete;
+
+    void countDown(int n = 1) {
+        if(count_.fetch_sub(n, memory_order_seq_cst) - n <= 0
+            && waiters_.load(memory_order_seq_cst) > 0) {
+            futexWake(count_, INT_MAX);
+        }
+    }
+
+    bool tryWait() const {
+        return count_.load(memory_order_acquire) <= 0;
+    }
+
+    void wait() {
+        for(int i = 0; i < spinCount(); i++) {
+            if(tryWait()) {
+                return;
+            }
+            cpuRelax();
+        }
+        waiters_.fetch_add(1, memory_order_seq_cst);
+        for(;;) {
+            int32_t count = count_.load(memory_order_seq_cst);
+            if(count <= 0) {
+                break;
+            }
+            futexWait(count_, count);
+        }
+        waiters_.fetch_sub(1, memory_order_relaxed);
+    }
+
+    void arriveAndWait(int n = 1) {
+        countDown(n);
+        wait();
+    }
+
+private:
+    atomic<int32_t> count_;
+    atomic<int32_t> waiters_;
+};
+
+/*
+* 可重复使用的屏障，sense-reversing：
+* 每一轮最后到达的线程重置计数并翻转代数generation_，其他线程先自旋等待代数变化，超过自旋次数再睡眠
+* 参与者在同一轮中同时到达时不会进入内核
+*/
+class SpinBarrier {
+public:
+    SpinBarrier(int count) : count_(count), remaining_(count), generation_(0), sleepers_(0) {}
+
+    SpinBarrier(const SpinBarrier&) = delete;
+    SpinBarrier& operator = (const SpinBarrier&) = delete;
+
+    void arriveAndWait() {
+        int32_t generation = generation_.load(memory_order_acquire);
+        if(remaining_.fetch_sub(1, memory_order_acq_rel) == 1) {
+            remaining_.store(count_, memory_order_relaxed);
+            generation_.fetch_add(1, memory_order_seq_cst);
+            if(sleepers_.load(memory_order_seq_cst) > 0) {
+                futexWake(generation_, INT_MAX);
+            }
+            return;
+        }
+
+        for(int i = 0; i < spinCount(); i++) {
+            if(generation_.load(memory_order_acquire) != generation) {
+                return;
+            }
+            cpuRelax();
+        }
+
+        sleepers_.fetch_add(1, memory_order_seq_cst);
+        while(generation_.load(memory_order_seq_cst) == generation) {
+            futexWait(generation_, generation);
+        }
+        sleepers_.fetch_sub(1, memory_order_relaxed);
+    }
+
+private:
+    const int32_t count_;
+    atomic<int32_t> remaining_;
+    atomic<int32_t> generation_;
+    atomic<int32_t> sleepers_;
+};
+
+#endif
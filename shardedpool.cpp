@@ -0,0 +1,241 @@
+#include "shardedpool.hpp"
+#include <chrono>
+#include <iostream>
+
+const int TASK_MAX_SHARD = 1024;
+const int THREADS_PER_SHARD = 4;
+
+/*
+* 工作线程睡眠的最长时间，作为唤醒丢失时的兜底
+*/
+const int SHARD_PARK_MS = 10;
+
+/*
+* 每个线程独立的xorshift随机数，选择分片时不需要共享状态
+*/
+static size_t nextRandom() {
+    thread_local uint64_t state = hash<thread::id>()(this_thread::get_id()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<size_t>(state);
+}
+
+ShardedThreadPool::ShardedThreadPool()
+    :taskCapacity(TASK_MAX_SHARD)
+     ,isRunning(false)
+{}
+
+ShardedThreadPool::~ShardedThreadPool() {
+    isRunning = false;
+    for(unique_ptr<Shard>& shard : shards) {
+        unique_lock<mutex> lock(shard->shardMutex);
+        shard->notEmpty.notify_all();
+    }
+    for(thread& t : threads) {
+        t.join();
+    }
+}
+
+void ShardedThreadPool::setTaskCapacity(int capacity) {
+    if(isRunning) {
+        cerr << "ShardedThreadPool is running, No setting!";
+        return;
+    }
+    taskCapacity = capacity;
+}
+
+void ShardedThreadPool::start(int size, int shardCount) {
+    if(isRunning) {
+        return;
+    }
+    if(size <= 0) {
+        size = 1;
+    }
+    if(shardCount <= 0) {
+        shardCount = (size + THREADS_PER_SHARD - 1) / THREADS_PER_SHARD;
+    }
+    if(shardCount > size) {
+        shardCount = size;
+    }
+
+    for(int i = 0; i < shardCount; i++) {
+        unique_ptr<Shard> shard = make_unique<Shard>();
+        shard->taskSize = 0;
+        shard->parkedThreads = 0;
+        shards.emplace_back(move(shard));
+    }
+
+    isRunning = true;
+    for(int i = 0; i < size; i++) {
+        threads.emplace_back(&ShardedThreadPool::threadFunc, this, i % shardCount);
+    }
+}
+
+ShardedThreadPool::Shard& ShardedThreadPool::pickShard() {
+    size_t count = shards.size();
+    if(count == 1) {
+        return *shards[0];
+    }
+    size_t r = nextRandom();
+    size_t a = r % count;
+    size_t b = (a + 1 + (r >> 32) % (count - 1)) % count;
+    return shards[a]->taskSize <= shards[b]->taskSize ? *shards[a] : *shards[b];
+}
+
+Result ShardedThreadPool::submitTask(shared_ptr<Task> task) {
+    /*
+    * Result必须在持有锁时构造，唤醒放在析构中，晚于后声明的lock释放
+    */
+    struct DeferredWake {
+        ShardedThreadPool* pool;
+        Shard* shard;
+        ~DeferredWake() {
+            if(shard != nullptr) {
+                pool->wakeWorker(*shard);
+            }
+        }
+    };
+
+    Shard& shard = pickShard();
+    DeferredWake wake{this, nullptr};
+    unique_lock<mutex> lock(shard.shardMutex);
+    if(!enqueueTask(shard, lock, task)) {
+        return Result(task, false);
+    }
+    wake.shard = &shard;
+
+    /*
+    * 与ThreadPool相同，持有锁构造Result，保证任务执行前Result已经绑定
+    */
+    return Result(task, true);
+}
+
+bool ShardedThreadPool::execute(shared_ptr<Task> task) {
+    Shard& shard = pickShard();
+    {
+        unique_lock<mutex> lock(shard.shardMutex);
+        if(!enqueueTask(shard, lock, task)) {
+            return false;
+        }
+    }
+    wakeWorker(shard);
+    return true;
+}
+
+bool ShardedThreadPool::execute(function<void()> func) {
+    return execute(make_shared<FuncTask>(move(func)));
+}
+
+bool ShardedThreadPool::enqueueTask(Shard& shard, unique_lock<mutex>& lock, shared_ptr<Task> task) {
+    if(!shard.notFull.wait_for(lock, chrono::seconds(1),
+        [&]()->bool { return taskCapacity > static_cast<int>(shard.taskSize); })) {
+        cerr << "Time out." << "\n";
+        return false;
+    }
+
+    shard.taskque.emplace(task);
+    shard.taskSize++;
+    return true;
+}
+
+void ShardedThreadPool::wakeWorker(Shard& shard) {
+    /*
+    * 本分片的线程在持有锁时检查队列后才睡眠，任务放入后一定能看到parkedThreads
+    */
+    if(shard.parkedThreads > 0) {
+        shard.notEmpty.notify_one();
+        return;
+    }
+
+    /*
+    * 本分片没有睡眠的线程时，唤醒其他分片的一个睡眠线程来取走任务
+    */
+    for(unique_ptr<Shard>& other : shards) {
+        if(other.get() != &shard && other->parkedThreads > 0) {
+            other->notEmpty.notify_one();
+            break;
+        }
+    }
+}
+
+shared_ptr<Task> ShardedThreadPool::dequeueTask(Shard& shard) {
+    if(shard.taskque.empty()) {
+        return nullptr;
+    }
+    shared_ptr<Task> task = shard.taskque.front();
+    shard.taskque.pop();
+    shard.taskSize--;
+    shard.notFull.notify_one();
+    return task;
+}
+
+shared_ptr<Task> ShardedThreadPool::stealTask(size_t self) {
+    size_t count = shards.size();
+
+    /*
+    * 第一轮跳过正在被使用的分片；被唤醒来取任务的线程如果只因为锁竞争没拿到，
+    * 第二轮在仍有任务的分片上等待锁，而不是回去睡眠一个SHARD_PARK_MS
+    */
+    for(int pass = 0; pass < 2; pass++) {
+        for(size_t i = 1; i < count; i++) {
+            Shard& victim = *shards[(self + i) % count];
+            if(victim.taskSize == 0) {
+                continue;
+            }
+            unique_lock<mutex> lock(victim.shardMutex, defer_lock);
+            if(pass == 0) {
+                if(!lock.try_lock()) {
+                    continue;
+                }
+            } else {
+                lock.lock();
+            }
+            shared_ptr<Task> task = dequeueTask(victim);
+            if(task != nullptr) {
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void ShardedThreadPool::threadFunc(size_t shardIndex) {
+    Shard& shard = *shards[shardIndex];
+
+    for(;;) {
+        shared_ptr<Task> task;
+        {
+            unique_lock<mutex> lock(shard.shardMutex);
+            task = dequeueTask(shard);
+        }
+
+        if(task == nullptr) {
+            task = stealTask(shardIndex);
+        }
+
+        if(task == nullptr) {
+            unique_lock<mutex> lock(shard.shardMutex);
+            if(shard.taskque.empty()) {
+                if(!isRunning) {
+                    /*
+                    * 退出前确认其他分片也已经清空
+                    */
+                    bool drained = true;
+                    for(unique_ptr<Shard>& other : shards) {
+                        drained = drained && other->taskSize == 0;
+                    }
+                    if(drained) {
+                        return;
+                    }
+                }
+                shard.parkedThreads++;
+                shard.notEmpty.wait_for(lock, chrono::milliseconds(SHARD_PARK_MS));
+                shard.parkedThreads--;
+            }
+            continue;
+        }
+
+        task->exec();
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef SHARDEDPOOL_H
+#define SHARDEDPOOL_H
+
+#include "threadpool.hpp"
+#include <thread>
+
+/*
+* example:
+* ShardedThreadPool pool;
+* pool.start(16, 4);
+* Result res = pool.submitTask(make_shared<MyTask>(0, 16384));
+*
+* 分片线程池：任务队列和锁拆成K个分片，每个分片有自己的一组工作线程。
+* 提交时随机选两个分片，放入任务较少的一个（power of two choices）；
+* 工作线程自己的分片为空时先扫描其他分片取任务，都为空才睡眠。
+* 使用方式与ThreadPool相同，只是任务之间不再保证全局的先进先出顺序。
+*/
+class ShardedThreadPool {
+public:
+    ShardedThreadPool();
+
+    /*
+    * 析构时等待队列中的任务执行完毕，然后回收所有工作线程
+    */
+    ~ShardedThreadPool();
+
+    ShardedThreadPool(const ShardedThreadPool&) = delete;
+    ShardedThreadPool& operator = (const ShardedThreadPool&) = delete;
+
+    /*
+    * 设置每个分片的任务队列阈值，需要在start之前调用
+    */
+    void setTaskCapacity(int capacity);
+
+    /*
+    * 启动size个工作线程，平均分配到shards个分片，shards为0时每4个线程一个分片
+    */
+    void start(int size = 4, int shards = 0);
+
+    Result submitTask(shared_ptr<Task> task);
+
+    bool execute(shared_ptr<Task> task);
+    bool execute(function<void()> func);
+
+private:
+    struct Shard {
+        mutex shardMutex;
+        condition_variable notEmpty;
+        condition_variable notFull;
+        queue<shared_ptr<Task>> taskque;
+
+        /*
+        * 提交者无锁读取，用于选择分片
+        */
+        atomic_uint taskSize;
+
+        /*
+        * 睡眠在notEmpty上的线程数
+        */
+        atomic_int parkedThreads;
+    };
+
+    /*
+    * 随机选两个分片，返回任务较少的一个
+    */
+    Shard& pickShard();
+
+    /*
+    * 等待分片不满并放入任务，调用前需持有分片的锁
+    */
+    bool enqueueTask(Shard& shard, unique_lock<mutex>& lock, shared_ptr<Task> task);
+
+    /*
+    * 唤醒一个睡眠线程取走刚放入shard的任务，本分片没有睡眠线程时唤醒其他分片的
+    * 需要在释放shard的锁之后调用，否则被唤醒的线程立即在锁上阻塞
+    */
+    void wakeWorker(Shard& shard);
+
+    /*
+    * 从分片中取任务，调用前需持有分片的锁
+    */
+    shared_ptr<Task> dequeueTask(Shard& shard);
+
+    /*
+    * 从其他分片中取任务，先只尝试加锁，所有分片都拿不到时再对仍有任务的分片阻塞加锁
+    */
+    shared_ptr<Task> stealTask(size_t self);
+
+    void threadFunc(size_t shardIndex);
+
+private:
+    vector<unique_ptr<Shard>> shards;
+    vector<thread> threads;
+    int taskCapacity;
+    atomic_bool isRunning;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "simd.hpp"
+
+namespace {
+
+/*
+* 内核用GCC向量扩展编写，向量宽度Bytes由调用它的目标函数决定：
+* 内核总是内联到带target属性的包装函数中，按包装函数的指令集生成代码
+*/
+template<typename T, size_t Bytes>
+struct Kernels {
+    typedef T Vec __attribute__((vector_size(Bytes)));
+
+    /*
+    * 按元素对齐的向量类型，用于从任意地址加载；may_alias允许通过它读取T数组
+    */
+    typedef T UnalignedVec __attribute__((vector_size(Bytes), aligned(sizeof(T)), may_alias));
+    static constexpr size_t LANES = Bytes / sizeof(T);
+
+    /*
+    * 4个累加器交替使用，隐藏向量加法的延迟
+    */
+    static inline __attribute__((always_inline)) T sum(const T* data, size_t n) {
+        Vec acc0 = Vec{}, acc1 = Vec{}, acc2 = Vec{}, acc3 = Vec{};
+        size_t i = 0;
+        for(; i + 4 * LANES <= n; i += 4 * LANES) {
+            acc0 += *reinterpret_cast<const UnalignedVec*>(data + i);
+            acc1 += *reinterpret_cast<const UnalignedVec*>(data + i + LANES);
+            acc2 += *reinterpret_cast<const UnalignedVec*>(data + i + 2 * LANES);
+            acc3 += *reinterpret_cast<const UnalignedVec*>(data + i + 3 * LANES);
+        }
+        for(; i + LANES <= n; i += LANES) {
+            acc0 += *reinterpret_cast<const UnalignedVec*>(data + i);
+        }
+        acc0 += acc1 + acc2 + acc3;
+        T result = 0;
+        for(size_t l = 0; l < LANES; l++) {
+            result += acc0[l];
+        }
+        for(; i < n; i++) {
+            result += data[i];
+        }
+        return result;
+    }
+
+    static inline __attribute__((always_inline)) T dot(const T* a, const T* b, size_t n) {
+        Vec acc0 = Vec{}, acc1 = Vec{}, acc2 = Vec{}, acc3 = Vec{};
+        size_t i = 0;
+        for(; i + 4 * LANES <= n; i += 4 * LANES) {
+            acc0 += *reinterpret_cast<const UnalignedVec*>(a + i) * *reinterpret_cast<const UnalignedVec*>(b + i);
+            acc1 += *reinterpret_cast<const UnalignedVec*>(a + i + LANES) * *reinterpret_cast<const UnalignedVec*>(b + i + LANES);
+            acc2 += *reinterpret_cast<const UnalignedVec*>(a + i + 2 * LANES) * *reinterpret_cast<const UnalignedVec*>(b + i + 2 * LANES);
+            acc3 += *reinterpret_cast<const UnalignedVec*>(a + i + 3 * LANES) * *reinterpret_cast<const UnalignedVec*>(b + i + 3 * LANES);
+        }
+        for(; i + LANES <= n; i += LANES) {
+            acc0 += *reinterpret_cast<const UnalignedVec*>(a + i) * *reinterpret_cast<const UnalignedVec*>(b + i);
+        }
+        acc0 += acc1 + acc2 + acc3;
+        T result = 0;
+        for(size_t l = 0; l < LANES; l++) {
+            result += acc0[l];
+        }
+        for(; i < n; i++) {
+            result += a[i] * b[i];
+        }
+        return result;
+    }
+
+    template<bool IsMin>
+    static inline __attribute__((always_inline)) T extreme(const T* data, size_t n) {
+        const T identity = IsMin ? numeric_limits<T>::infinity() : -numeric_limits<T>::infinity();
+        Vec acc0 = Vec{} + identity, acc1 = Vec{} + identity;
+        size_t i = 0;
+        for(; i + 2 * LANES <= n; i += 2 * LANES) {
+            Vec v0 = *reinterpret_cast<const UnalignedVec*>(data + i);
+            Vec v1 = *reinterpret_cast<const UnalignedVec*>(data + i + LANES);
+            acc0 = IsMin ? (v0 < acc0 ? v0 : acc0) : (v0 > acc0 ? v0 : acc0);
+            acc1 = IsMin ? (v1 < acc1 ? v1 : acc1) : (v1 > acc1 ? v1 : acc1);
+        }
+        for(; i + LANES <= n; i += LANES) {
+            Vec v = *reinterpret_cast<const UnalignedVec*>(data + i);
+            acc0 = IsMin ? (v < acc0 ? v : acc0) : (v > acc0 ? v : acc0);
+        }
+        acc0 = IsMin ? (acc1 < acc0 ? acc1 : acc0) : (acc1 > acc0 ? acc1 : acc0);
+        T result = identity;
+        for(size_t l = 0; l < LANES; l++) {
+            result = IsMin ? min(result, acc0[l]) : max(result, acc0[l]);
+        }
+        for(; i < n; i++) {
+            result = IsMin ? min(result, data[i]) : max(result, data[i]);
+        }
+        return result;
+    }
+};
+
+/*
+* 每种指令集一组包装函数，函数指针表在第一次使用时按simdLevel()选择
+*/
+template<typename T>
+struct KernelTable {
+    T (*sum)(const T*, size_t);
+    T (*min)(const T*, size_t);
+    T (*max)(const T*, size_t);
+    T (*dot)(const T*, const T*, size_t);
+};
+
+#define DEFINE_SIMD_KERNELS(NAME, TARGET, BYTES) \
+    template<typename T> __attribute__((target(TARGET))) T sum##NAME(const T* p, size_t n) { \
+        return Kernels<T, BYTES>::sum(p, n); \
+    } \
+    template<typename T> __attribute__((target(TARGET))) T min##NAME(const T* p, size_t n) { \
+        return Kernels<T, BYTES>::template extreme<true>(p, n); \
+    } \
+    template<typename T> __attribute__((target(TARGET))) T max##NAME(const T* p, size_t n) { \
+        return Kernels<T, BYTES>::template extreme<false>(p, n); \
+    } \
+    template<typename T> __attribute__((target(TARGET))) T dot##NAME(const T* a, const T* b, size_t n) { \
+        return Kernels<T, BYTES>::dot(a, b, n); \
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+DEFINE_SIMD_KERNELS(Sse2, "sse2", 16)
+DEFINE_SIMD_KERNELS(Avx2, "avx2", 32)
+DEFINE_SIMD_KERNELS(Avx512, "avx512f", 64)
+#endif
+
+/*
+* 标量版本使用8 * sizeof(T)字节（8个元素）的通用向量，只是为了复用同一份内核代码；
+* 没有target属性，编译器按基线指令集拆分成多条指令或逐元素计算
+*/
+template<typename T> T sumScalar(const T* p, size_t n) { return Kernels<T, 8 * sizeof(T)>::sum(p, n); }
+template<typename T> T minScalar(const T* p, size_t n) { return Kernels<T, 8 * sizeof(T)>::template extreme<true>(p, n); }
+template<typename T> T maxScalar(const T* p, size_t n) { return Kernels<T, 8 * sizeof(T)>::template extreme<false>(p, n); }
+template<typename T> T dotScalar(const T* a, const T* b, size_t n) { return Kernels<T, 8 * sizeof(T)>::dot(a, b, n); }
+
+template<typename T>
+const KernelTable<T>& kernels() {
+    static const KernelTable<T> table = []() {
+        switch(simdLevel()) {
+#if defined(__x86_64__) || defined(__i386__)
+        case SimdLevel::AVX512:
+            return KernelTable<T>{sumAvx512<T>, minAvx512<T>, maxAvx512<T>, dotAvx512<T>};
+        case SimdLevel::AVX2:
+            return KernelTable<T>{sumAvx2<T>, minAvx2<T>, maxAvx2<T>, dotAvx2<T>};
+        case SimdLevel::SSE2:
+            return KernelTable<T>{sumSse2<T>, minSse2<T>, maxSse2<T>, dotSse2<T>};
+#endif
+        default:
+            return KernelTable<T>{sumScalar<T>, minScalar<T>, maxScalar<T>, dotScalar<T>};
+        }
+    }();
+    return table;
+}
+
+}
+
+SimdLevel simdLevel() {
+    static const SimdLevel level = []() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) {
+            return SimdLevel::AVX512;
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        }
+        if(__builtin_cpu_supports("sse2")) {
+            return SimdLevel::SSE2;
+        }
+#endif
+        return SimdLevel::SCALAR;
+    }();
+    return level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch(level) {
+    case SimdLevel::AVX512:
+        return "avx512";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+float simdSum(const float* data, size_t n) {
+    return kernels<float>().sum(data, n);
+}
+
+double simdSum(const double* data, size_t n) {
+    return kernels<double>().sum(data, n);
+}
+
+float simdMin(const float* data, size_t n) {
+    return kernels<float>().min(data, n);
+}
+
+double simdMin(const double* data, size_t n) {
+    return kernels<double>().min(data, n);
+}
+
+float simdMax(const float* data, size_t n) {
+    return kernels<float>().max(data, n);
+}
+
+double simdMax(const double* data, size_t n) {
+    return kernels<double>().max(data, n);
+}
+
+float simdDot(const float* a, const float* b, size_t n) {
+    return kernels<float>().dot(a, b, n);
+}
+
+double simdDot(const double* a, const double* b, size_t n) {
+    return kernels<double>().dot(a, b, n);
+}
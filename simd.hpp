@@ -0,0 +1,188 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "parallel.hpp"
+#include <limits>
+#include <span>
+
+/*
+* 运行时检测到的向量指令集，第一次调用时用__builtin_cpu_supports检测
+*/
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+SimdLevel simdLevel();
+const char* simdLevelName(SimdLevel level);
+
+/*
+* 单线程的向量化内核，按simdLevel()分派到SSE2/AVX2/AVX-512实现
+* 每个内核使用多个累加器隐藏加法延迟；浮点求和的结果与顺序累加可能有舍入误差上的差别
+* 空区间时sum和dot返回0，min返回该类型的最大值，max返回最小值（浮点为正负无穷）
+*/
+float simdSum(const float* data, size_t n);
+double simdSum(const double* data, size_t n);
+float simdMin(const float* data, size_t n);
+double simdMin(const double* data, size_t n);
+float simdMax(const float* data, size_t n);
+double simdMax(const double* data, size_t n);
+float simdDot(const float* a, const float* b, size_t n);
+double simdDot(const double* a, const double* b, size_t n);
+
+/*
+* 把[0, n)切成大约chunkBytes字节的块，除第一块外每块都从base开始的64字节对齐地址开始，
+* 向量加载不会跨越块边界上的缓存行，写输出的任务之间也不会共享缓存行
+*/
+inline vector<pair<size_t, size_t>> alignedChunks(const void* base, size_t n, size_t elementSize,
+                                                   size_t chunkBytes = 256 * 1024) {
+    vector<pair<size_t, size_t>> chunks;
+    if(n == 0) {
+        return chunks;
+    }
+    size_t chunkElements = max<size_t>(chunkBytes / elementSize, 1);
+    uintptr_t address = reinterpret_cast<uintptr_t>(base);
+    size_t begin = 0;
+    while(begin < n) {
+        size_t end = begin + chunkElements;
+        if(end < n) {
+            uintptr_t boundary = (address + end * elementSize + 63) & ~static_cast<uintptr_t>(63);
+            end = (boundary - address) / elementSize;
+        }
+        end = min(end, n);
+        chunks.emplace_back(begin, end);
+        begin = end;
+    }
+    return chunks;
+}
+
+/*
+* 每个块在线程池中用kernel归约，块的结果再在调用线程中用combine合并
+*/
+template<typename T, typename Kernel, typename Combine>
+T parallelReduce(ThreadPool& pool, const T* data, size_t n, T identity, Kernel kernel, Combine combine) {
+    vector<pair<size_t, size_t>> chunks = alignedChunks(data, n, sizeof(T));
+    vector<T> partials(chunks.size(), identity);
+    parallel_for(pool, chunks.size(), [&](size_t c) {
+        partials[c] = kernel(data + chunks[c].first, chunks[c].second - chunks[c].first);
+    });
+    T result = identity;
+    for(T partial : partials) {
+        result = combine(result, partial);
+    }
+    return result;
+}
+
+/*
+* example:
+* vector<float> samples = load();
+* float total = parallel_sum(pool, samples);
+* float peak = parallel_max(pool, samples);
+*
+* 并行归约：数据按64字节对齐的边界分块，每个块作为线程池任务用向量化内核处理
+*/
+inline float parallel_sum(ThreadPool& pool, span<const float> data) {
+    return parallelReduce(pool, data.data(), data.size(), 0.0f,
+                          [](const float* p, size_t n) { return simdSum(p, n); },
+                          [](float a, float b) { return a + b; });
+}
+
+inline double parallel_sum(ThreadPool& pool, span<const double> data) {
+    return parallelReduce(pool, data.data(), data.size(), 0.0,
+                          [](const double* p, size_t n) { return simdSum(p, n); },
+                          [](double a, double b) { return a + b; });
+}
+
+inline float parallel_min(ThreadPool& pool, span<const float> data) {
+    return parallelReduce(pool, data.data(), data.size(), numeric_limits<float>::infinity(),
+                          [](const float* p, size_t n) { return simdMin(p, n); },
+                          [](float a, float b) { return min(a, b); });
+}
+
+inline double parallel_min(ThreadPool& pool, span<const double> data) {
+    return parallelReduce(pool, data.data(), data.size(), numeric_limits<double>::infinity(),
+                          [](const double* p, size_t n) { return simdMin(p, n); },
+                          [](double a, double b) { return min(a, b); });
+}
+
+inline float parallel_max(ThreadPool& pool, span<const float> data) {
+    return parallelReduce(pool, data.data(), data.size(), -numeric_limits<float>::infinity(),
+                          [](const float* p, size_t n) { return simdMax(p, n); },
+                          [](float a, float b) { return max(a, b); });
+}
+
+inline double parallel_max(ThreadPool& pool, span<const double> data) {
+    return parallelReduce(pool, data.data(), data.size(), -numeric_limits<double>::infinity(),
+                          [](const double* p, size_t n) { return simdMax(p, n); },
+                          [](double a, double b) { return max(a, b); });
+}
+
+/*
+* 点积，a和b长度必须相同，分块边界按a对齐
+*/
+template<typename T>
+T parallelDot(ThreadPool& pool, span<const T> a, span<const T> b) {
+    size_t n = min(a.size(), b.size());
+    vector<pair<size_t, size_t>> chunks = alignedChunks(a.data(), n, sizeof(T));
+    vector<T> partials(chunks.size(), T(0));
+    parallel_for(pool, chunks.size(), [&](size_t c) {
+        size_t begin = chunks[c].first;
+        partials[c] = simdDot(a.data() + begin, b.data() + begin, chunks[c].second - begin);
+    });
+    T result = 0;
+    for(T partial : partials) {
+        result += partial;
+    }
+    return result;
+}
+
+inline float parallel_dot(ThreadPool& pool, span<const float> a, span<const float> b) {
+    return parallelDot<float>(pool, a, b);
+}
+
+inline double parallel_dot(ThreadPool& pool, span<const double> a, span<const double> b) {
+    return parallelDot<double>(pool, a, b);
+}
+
+/*
+* 统计满足pred的元素个数，pred在内核中内联，简单的比较可以被编译器向量化
+*/
+template<typename T, typename Pred>
+size_t parallel_count_if(ThreadPool& pool, span<const T> data, Pred pred) {
+    vector<pair<size_t, size_t>> chunks = alignedChunks(data.data(), data.size(), sizeof(T));
+    vector<size_t> partials(chunks.size(), 0);
+    parallel_for(pool, chunks.size(), [&](size_t c) {
+        size_t count = 0;
+        const T* p = data.data();
+        for(size_t i = chunks[c].first; i < chunks[c].second; i++) {
+            count += pred(p[i]) ? 1 : 0;
+        }
+        partials[c] = count;
+    });
+    size_t result = 0;
+    for(size_t partial : partials) {
+        result += partial;
+    }
+    return result;
+}
+
+/*
+* out[i] = func(in[i])，out至少与in一样长
+* 分块边界按输出对齐，不同任务不会写同一个缓存行
+*/
+template<typename In, typename Out, typename Func>
+void parallel_transform(ThreadPool& pool, span<const In> in, span<Out> out, Func func) {
+    size_t n = min(in.size(), out.size());
+    vector<pair<size_t, size_t>> chunks = alignedChunks(out.data(), n, sizeof(Out));
+    parallel_for(pool, chunks.size(), [&](size_t c) {
+        const In* src = in.data();
+        Out* dst = out.data();
+        for(size_t i = chunks[c].first; i < chunks[c].second; i++) {
+            dst[i] = func(src[i]);
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include <chrono>
+#include <list>
+#include <unordered_map>
+
+/*
+* 一次执行的共享状态，相同key的所有提交者都等待同一个Flight
+*/
+template<typename V>
+class Flight {
+public:
+    Flight() : done_(false) {}
+
+    void set(V value) {
+        unique_lock<mutex> lock(mutex_);
+        value_ = move(value);
+        done_ = true;
+        cond_.notify_all();
+    }
+
+    const V& wait() {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        cond_.wait(lock, [&]()->bool { return done_; });
+        return value_;
+    }
+
+private:
+    V value_;
+    bool done_;
+    mutex mutex_;
+    condition_variable cond_;
+};
+
+/*
+* submit的返回值，get()可以多次调用，每次返回结果的拷贝
+* isShared()表示这次提交没有触发新的执行，而是复用了正在执行或已缓存的结果
+*/
+template<typename V>
+class FlightResult {
+public:
+    FlightResult(shared_ptr<Flight<V>> flight, bool shared)
+        : flight_(move(flight)), shared_(shared)
+    {}
+
+    V get() {
+        return flight_->wait();
+    }
+
+    bool isShared() const {
+        return shared_;
+    }
+
+private:
+    shared_ptr<Flight<V>> flight_;
+    bool shared_;
+};
+
+/*
+* example:
+* SingleFlight<string, Profile> flights(pool, 1024, chrono::seconds(5));
+* FlightResult<Profile> res = flights.submit(userId, [=]() { return loadProfile(userId); });
+* Profile profile = res.get();
+*
+* 重复请求抑制：同一个key并发提交的幂等任务只执行一次，所有提交者共享同一个结果。
+* cacheCapacity大于0时，完成的结果按LRU缓存，ttl为0表示缓存不过期。
+*/
+template<typename K, typename V, typename Hash = hash<K>>
+class SingleFlight {
+public:
+    SingleFlight(ThreadPool& pool,
+                 size_t cacheCapacity = 0,
+                 chrono::milliseconds ttl = chrono::milliseconds(0))
+        : pool_(pool)
+        , cacheCapacity_(cacheCapacity)
+        , ttl_(ttl)
+    {}
+
+    /*
+    * 任务持有this，析构前等待正在执行的任务完成
+    */
+    ~SingleFlight() {
+        CpuBudget::BlockingRegion region;
+        unique_lock<mutex> lock(mutex_);
+        idle_.wait(lock, [&]()->bool { return inflight_.empty(); });
+    }
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator = (const SingleFlight&) = delete;
+
+    FlightResult<V> submit(const K& key, function<V()> func) {
+        shared_ptr<Flight<V>> flight;
+        {
+            unique_lock<mutex> lock(mutex_);
+
+            /*
+            * 先查缓存，再查正在执行的任务
+            */
+            auto cached = cache_.find(key);
+            if(cached != cache_.end()) {
+                if(!expired(cached->second)) {
+                    lru_.splice(lru_.begin(), lru_, cached->second.lruPos);
+                    return FlightResult<V>(cached->second.flight, true);
+                }
+                lru_.erase(cached->second.lruPos);
+                cache_.erase(cached);
+            }
+
+            auto running = inflight_.find(key);
+            if(running != inflight_.end()) {
+                return FlightResult<V>(running->second, true);
+            }
+
+            flight = make_shared<Flight<V>>();
+            inflight_.emplace(key, flight);
+        }
+
+        shared_ptr<FuncTask> task = make_shared<FuncTask>([this, key, flight, func = move(func)]() {
+            flight->set(func());
+            finish(key, flight);
+        });
+
+        /*
+        * 队列已满时不等待空位，直接在当前线程执行，否则等待该key的提交者永远拿不到结果
+        */
+        if(!pool_.tryExecute(task)) {
+            task->exec();
+        }
+        return FlightResult<V>(flight, false);
+    }
+
+    /*
+    * 删除缓存的结果，下一次提交会重新执行
+    */
+    void forget(const K& key) {
+        unique_lock<mutex> lock(mutex_);
+        auto cached = cache_.find(key);
+        if(cached != cache_.end()) {
+            lru_.erase(cached->second.lruPos);
+            cache_.erase(cached);
+        }
+    }
+
+private:
+    struct CacheEntry {
+        shared_ptr<Flight<V>> flight;
+        chrono::steady_clock::time_point expireTime;
+        typename list<K>::iterator lruPos;
+    };
+
+    bool expired(const CacheEntry& entry) const {
+        return ttl_.count() > 0 && chrono::steady_clock::now() >= entry.expireTime;
+    }
+
+    /*
+    * 执行完成后从inflight_移入缓存，超出容量时淘汰最久未使用的结果
+    */
+    void finish(const K& key, const shared_ptr<Flight<V>>& flight) {
+        unique_lock<mutex> lock(mutex_);
+        inflight_.erase(key);
+
+        if(cacheCapacity_ > 0) {
+            auto cached = cache_.find(key);
+            if(cached != cache_.end()) {
+                lru_.erase(cached->second.lruPos);
+                cache_.erase(cached);
+            }
+            if(cache_.size() >= cacheCapacity_) {
+                cache_.erase(lru_.back());
+                lru_.pop_back();
+            }
+            lru_.push_front(key);
+            cache_.emplace(key, CacheEntry{flight, chrono::steady_clock::now() + ttl_, lru_.begin()});
+        }
+
+        if(inflight_.empty()) {
+            idle_.notify_all();
+        }
+    }
+
+private:
+    ThreadPool& pool_;
+    size_t cacheCapacity_;
+    chrono::milliseconds ttl_;
+
+    unordered_map<K, shared_ptr<Flight<V>>, Hash> inflight_;
+    unordered_map<K, CacheEntry, Hash> cache_;
+
+    /*
+    * 链表头部是最近使用的key
+    */
+    list<K> lru_;
+
+    mutex mutex_;
+    condition_variable idle_;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "spillfile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t SPILL_INITIAL_SIZE = 1 << 20;
+
+/*
+* 每次预先分配的磁盘空间
+*/
+const size_t SPILL_ALLOCATE_SIZE = 1 << 20;
+
+/*
+* 已读前缀累计到该大小时释放一次磁盘块，按页对齐，不会碰到尚未读完的记录
+*/
+const size_t SPILL_PUNCH_SIZE = 1 << 20;
+const size_t SPILL_PAGE_SIZE = 4096;
+
+}
+
+SpillFile::SpillFile()
+    :fd_(-1)
+     ,data_(nullptr)
+     ,mapped_(0)
+     ,writeOffset_(0)
+     ,readOffset_(0)
+     ,allocated_(0)
+     ,punchedOffset_(0)
+{}
+
+SpillFile::~SpillFile() {
+    if(data_ != nullptr) {
+        munmap(data_, mapped_);
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool SpillFile::open(const string& path) {
+    if(fd_ >= 0) {
+        return false;
+    }
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd_ < 0) {
+        return false;
+    }
+    unlink(path.c_str());
+
+    if(ftruncate(fd_, SPILL_INITIAL_SIZE) != 0) {
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    void* addr = mmap(nullptr, SPILL_INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(addr == MAP_FAILED) {
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    data_ = static_cast<char*>(addr);
+    mapped_ = SPILL_INITIAL_SIZE;
+    madvise(data_, mapped_, MADV_SEQUENTIAL);
+    return true;
+}
+
+bool SpillFile::append(const string& payload) {
+    if(data_ == nullptr || payload.size() > UINT32_MAX) {
+        return false;
+    }
+    size_t record = sizeof(uint32_t) + payload.size();
+    if(!reserve(record)) {
+        return false;
+    }
+
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    memcpy(data_ + writeOffset_, &length, sizeof(length));
+    memcpy(data_ + writeOffset_ + sizeof(length), payload.data(), payload.size());
+    writeOffset_ += record;
+    return true;
+}
+
+bool SpillFile::pop(string& payload) {
+    if(empty()) {
+        return false;
+    }
+    uint32_t length;
+    memcpy(&length, data_ + readOffset_, sizeof(length));
+    payload.assign(data_ + readOffset_ + sizeof(length), length);
+    readOffset_ += sizeof(length) + length;
+
+    /*
+    * 全部读回后从头开始复用文件，已经读过的部分不再需要写回磁盘
+    */
+    if(readOffset_ == writeOffset_) {
+        punch(allocated_);
+        readOffset_ = 0;
+        writeOffset_ = 0;
+        allocated_ = 0;
+        punchedOffset_ = 0;
+    } else if(readOffset_ - punchedOffset_ >= SPILL_PUNCH_SIZE) {
+        punch(readOffset_ / SPILL_PAGE_SIZE * SPILL_PAGE_SIZE);
+    }
+    return true;
+}
+
+bool SpillFile::empty() const {
+    return readOffset_ == writeOffset_;
+}
+
+size_t SpillFile::pendingBytes() const {
+    return writeOffset_ - readOffset_;
+}
+
+bool SpillFile::reserve(size_t bytes) {
+    if(writeOffset_ + bytes > mapped_) {
+        /*
+        * 已读前缀占了一半以上时先压缩，文件大小跟随未读数据量而不是累计写入量
+        */
+        if(readOffset_ >= mapped_ / 2 && !compact()) {
+            return false;
+        }
+        if(writeOffset_ + bytes > mapped_) {
+            size_t size = mapped_;
+            while(size < writeOffset_ + bytes) {
+                size *= 2;
+            }
+            if(ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+                return false;
+            }
+            void* addr = mremap(data_, mapped_, size, MREMAP_MAYMOVE);
+            if(addr == MAP_FAILED) {
+                return false;
+            }
+            data_ = static_cast<char*>(addr);
+            mapped_ = size;
+            madvise(data_, mapped_, MADV_SEQUENTIAL);
+        }
+    }
+
+    /*
+    * ftruncate扩出来的部分和释放过的部分都是空洞，写映射区时才分配磁盘块，空间不足会收到SIGBUS；
+    * 写入前先分配，失败时返回false
+    */
+    if(writeOffset_ + bytes > allocated_) {
+        size_t end = min(mapped_, max(writeOffset_ + bytes, allocated_ + SPILL_ALLOCATE_SIZE));
+        size_t begin = max(allocated_, writeOffset_);
+        if(posix_fallocate(fd_, static_cast<off_t>(begin), static_cast<off_t>(end - begin)) != 0) {
+            return false;
+        }
+        allocated_ = end;
+    }
+    return true;
+}
+
+bool SpillFile::compact() {
+    size_t pending = writeOffset_ - readOffset_;
+
+    /*
+    * 目标区域可能已经被释放，先分配再搬移，失败时文件保持原样
+    */
+    if(pending > 0 && posix_fallocate(fd_, 0, static_cast<off_t>(pending)) != 0) {
+        return false;
+    }
+    memmove(data_, data_ + readOffset_, pending);
+
+    /*
+    * [pending, writeOffset_)中可能有已经释放的空洞，只保证搬移后的数据之前的部分已分配
+    */
+    punchedOffset_ = 0;
+    readOffset_ = 0;
+    writeOffset_ = pending;
+    allocated_ = pending;
+    return true;
+}
+
+void SpillFile::punch(size_t end) {
+    if(end > punchedOffset_) {
+        fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  static_cast<off_t>(punchedOffset_), static_cast<off_t>(end - punchedOffset_));
+        punchedOffset_ = end;
+    }
+}
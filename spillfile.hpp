@@ -0,0 +1,90 @@
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+/*
+* example:
+* SpillFile spill;
+* spill.open("/tmp/pool.spill");
+* spill.append(payload);
+* string next;
+* while(spill.pop(next)) {...}
+*
+* 只追加的内存映射溢写文件，记录按写入顺序先进先出地读回
+* 每条记录是4字节长度加负载；写入前用posix_fallocate分配磁盘块，磁盘空间不足时append返回false，
+* 而不是在写映射区时收到SIGBUS。
+* 写满映射区时，如果已经读过的前缀超过一半，把未读的记录搬到文件开头；否则用ftruncate + mremap扩大一倍，
+* 文件大小因此不超过未读数据量的两倍左右。
+* 读回的过程中每读过SPILL_PUNCH_SIZE字节就用PUNCH_HOLE释放已经读过的磁盘块，持续过载时磁盘占用也不会一直增长。
+* 文件打开后立即unlink，进程退出（包括崩溃）时由内核回收。
+* 不是线程安全的，由调用者加锁。
+*/
+class SpillFile {
+public:
+    SpillFile();
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator = (const SpillFile&) = delete;
+
+    /*
+    * 创建溢写文件，失败返回false
+    */
+    bool open(const string& path);
+
+    /*
+    * 追加一条记录，磁盘空间不足等原因无法扩展文件时返回false
+    */
+    bool append(const string& payload);
+
+    /*
+    * 读出最早的一条记录，没有记录时返回false
+    */
+    bool pop(string& payload);
+
+    bool empty() const;
+
+    /*
+    * 尚未读回的字节数
+    */
+    size_t pendingBytes() const;
+
+private:
+    /*
+    * 保证[writeOffset_, writeOffset_ + bytes)已经映射并分配了磁盘块
+    */
+    bool reserve(size_t bytes);
+
+    /*
+    * 把未读的记录搬到文件开头
+    */
+    bool compact();
+
+    /*
+    * 释放[punchedOffset_, end)的磁盘块
+    */
+    void punch(size_t end);
+
+private:
+    int fd_;
+    char* data_;
+    size_t mapped_;
+    size_t writeOffset_;
+    size_t readOffset_;
+
+    /*
+    * [writeOffset_, allocated_)已经分配了磁盘块
+    */
+    size_t allocated_;
+
+    /*
+    * [0, punchedOffset_)的磁盘块已经释放
+    */
+    size_t punchedOffset_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+/*
+* 单生产者单消费者无锁环形队列
+* 生产者只写tail_，消费者只写head_，两者放在不同的缓存行上；
+* 各自缓存对方的下标，只有缓存的下标显示队列满/空时才去读对方的原子变量，减少跨核缓存行传输
+*/
+template<typename T>
+class SpscRing {
+public:
+    SpscRing(size_t capacity) : head_(0), cachedTail_(0), tail_(0), cachedHead_(0) {
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator = (const SpscRing&) = delete;
+
+    /*
+    * 生产者调用，队列已满返回false，value保持不变
+    */
+    bool push(T& value) {
+        size_t tail = tail_.load(memory_order_relaxed);
+        if(tail - cachedHead_ > mask_) {
+            cachedHead_ = head_.load(memory_order_acquire);
+            if(tail - cachedHead_ > mask_) {
+                return false;
+            }
+        }
+        buffer_[tail & mask_] = move(value);
+        tail_.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    /*
+    * 消费者调用，队列为空返回false
+    */
+    bool pop(T& out) {
+        size_t head = head_.load(memory_order_relaxed);
+        if(head == cachedTail_) {
+            cachedTail_ = tail_.load(memory_order_acquire);
+            if(head == cachedTail_) {
+                return false;
+            }
+        }
+        out = move(buffer_[head & mask_]);
+        buffer_[head & mask_] = T();
+        head_.store(head + 1, memory_order_release);
+        return true;
+    }
+
+    /*
+    * 任意线程调用，结果只是一个瞬时快照
+    */
+    bool empty() const {
+        return head_.load(memory_order_acquire) == tail_.load(memory_order_acquire);
+    }
+
+private:
+    alignas(64) atomic<size_t> head_;
+    size_t cachedTail_;
+
+    alignas(64) atomic<size_t> tail_;
+    size_t cachedHead_;
+
+    alignas(64) vector<T> buffer_;
+    size_t mask_;
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "threadpool.hpp"
+#include "cpubudget.hpp"
+#include "cpuquota.hpp"
+#include "epoch.hpp"
+#include "spillfile.hpp"
 #include <thread>
 #include <iostream>
 #include <mutex>
@@ -6,9 +10,11 @@
 
 using namespace std;
 
-const int TASK_MAX_THREADPOOL = 1024;
-const int THREAD_MAX_THREADPOOL = 10;
-const int TIME_OUT = 60;
+/*
+ * 为成组任务预留的线程最多等待这么久，之后暂时离开预留去执行一个排队的普通任务
+ */
+const chrono::milliseconds GANG_RESERVE_WAIT(10);
+
 /*
  * 默认线程池模式为固定大小
  * 初始化线程数量，任务数量、线程池阈值
@@ -16,34 +22,167 @@ const int TIME_OUT = 60;
 
 ThreadPool::ThreadPool()
     :initThreadSize(0)
+     ,threadCapacity(THREAD_PER_CPU_THREADPOOL * availableCpus())
+     ,currentThreadSize(0)
+     ,retireRequests(0)
+     ,reservedThreads(0)
      ,taskSize(0)
      ,taskCapacity(TASK_MAX_THREADPOOL)
+     ,cpuBudget(nullptr)
+     ,budgetMember(nullptr)
      ,poolMode(PoolMode::MODE_FIXED)
+     ,keepAlive(KEEP_ALIVE_THREADPOOL)
+     ,spinBudget(0)
+     ,timeSliceUs(0)
      ,isRunning(false)
      ,idleThreadSize(0)
-     ,threadCapacity(THREAD_MAX_THREADPOOL)
-     ,currentThreadSize(0) 
 {}
 
 ThreadPool::~ThreadPool() {
-    
+    {
+        unique_lock<mutex> lock(taskqueMutex);
+        isRunning = false;
+
+        /*
+        * 唤醒所有空闲线程，它们发现队列为空且线程池已停止后退出；
+        * 正在执行任务的线程执行完后会继续取队列中剩余的任务，取完再退出
+        */
+        notEmpty.notify_all();
+        exitCond.wait(lock, [&]()->bool { return threads.empty(); });
+    }
+
+    if(cpuBudget != nullptr) {
+        cpuBudget->leave(budgetMember);
+    }
 }
 
 void ThreadPool::setMode(PoolMode mode) {
-    if(checkRunning()) {
-        poolMode = mode;
-    } else {
-        cerr << "ThreadPool is running, No setting!";
-    }
-    return;
+    lock_guard<mutex> lock(taskqueMutex);
+    PoolConfig config = currentConfig();
+    config.mode = mode;
+    applyConfig(config);
 }
 
 void ThreadPool::setTaskCapacity(int capacity) {
-    taskSize = capacity;
+    lock_guard<mutex> lock(taskqueMutex);
+    PoolConfig config = currentConfig();
+    config.taskCapacity = capacity;
+    if(!applyConfig(config)) {
+        cerr << "Invalid task capacity, No setting!";
+    }
 }
 
 void ThreadPool::setThreadCapacity(int thread_capacity) {
-    threadCapacity =  thread_capacity;
+    lock_guard<mutex> lock(taskqueMutex);
+    PoolConfig config = currentConfig();
+    config.maxThreads = thread_capacity;
+    if(!applyConfig(config)) {
+        cerr << "Invalid thread capacity, No setting!";
+    }
+}
+
+bool ThreadPool::reconfigure(const PoolConfig& config) {
+    lock_guard<mutex> lock(taskqueMutex);
+    return applyConfig(config);
+}
+
+PoolConfig ThreadPool::getConfig() {
+    lock_guard<mutex> lock(taskqueMutex);
+    return currentConfig();
+}
+
+void ThreadPool::setTimeSlice(chrono::microseconds slice) {
+    lock_guard<mutex> lock(taskqueMutex);
+    PoolConfig config = currentConfig();
+    config.timeSlice = slice;
+    if(!applyConfig(config)) {
+        cerr << "Invalid time slice, No setting!";
+    }
+}
+
+PoolConfig ThreadPool::currentConfig() const {
+    PoolConfig config;
+    config.coreThreads = static_cast<int>(initThreadSize);
+    config.maxThreads = threadCapacity;
+    config.taskCapacity = taskCapacity;
+    config.keepAlive = keepAlive;
+    config.spinCount = spinBudget.load(memory_order_relaxed);
+    config.timeSlice = chrono::microseconds(timeSliceUs.load(memory_order_relaxed));
+    config.mode = poolMode;
+    return config;
+}
+
+bool ThreadPool::applyConfig(const PoolConfig& config) {
+    /*
+    * 启动前coreThreads可以为0，表示由start决定；maxThreads为0表示使用默认上限
+    */
+    int maxThreads = config.maxThreads;
+    if(maxThreads == 0) {
+        maxThreads = max(config.coreThreads, THREAD_PER_CPU_THREADPOOL * availableCpus());
+    }
+    if(config.coreThreads < (checkRunning() ? 1 : 0) || maxThreads < max(config.coreThreads, 1)
+        || config.taskCapacity < 1 || config.keepAlive.count() < 1 || config.spinCount < 0
+        || config.timeSlice.count() < 0) {
+        return false;
+    }
+
+    bool capacityGrew = config.taskCapacity > taskCapacity;
+    initThreadSize = config.coreThreads;
+    threadCapacity = maxThreads;
+    taskCapacity = config.taskCapacity;
+    keepAlive = config.keepAlive;
+    spinBudget.store(config.spinCount, memory_order_relaxed);
+    timeSliceUs.store(config.timeSlice.count(), memory_order_relaxed);
+    poolMode = config.mode;
+
+    /*
+    * fixed模式的线程数就是coreThreads；cached模式保留已经扩出来的线程，但不能超出[coreThreads, maxThreads]
+    */
+    if(checkRunning()) {
+        int target = currentThreadSize - retireRequests;
+        if(poolMode == PoolMode::MODE_FIXED) {
+            target = config.coreThreads;
+        } else {
+            target = max(config.coreThreads, min(target, maxThreads));
+        }
+        resizeThreads(target);
+    }
+
+    /*
+    * 队列阈值增大后先读回溢写的任务，再唤醒等待空位的提交者
+    */
+    if(capacityGrew) {
+        pageInSpilled();
+        notFull.notify_all();
+    }
+
+    /*
+    * 模式和存活时间的变化需要睡眠中的线程重新检查
+    */
+    notEmpty.notify_all();
+    return true;
+}
+
+void ThreadPool::setCpuBudget(CpuBudget& budget) {
+    if(checkRunning() || cpuBudget != nullptr) {
+        cerr << "ThreadPool is running or already has a budget, No setting!";
+        return;
+    }
+    cpuBudget = &budget;
+    budgetMember = budget.join();
+}
+
+bool ThreadPool::setOverflowSpill(const string& path) {
+    unique_ptr<SpillFile> file = make_unique<SpillFile>();
+    if(!file->open(path)) {
+        return false;
+    }
+    lock_guard<mutex> lock(taskqueMutex);
+    if(spillFile != nullptr) {
+        return false;
+    }
+    spillFile = move(file);
+    return true;
 }
 
 /*
@@ -59,91 +198,336 @@ Result ThreadPool::submitTask(shared_ptr<Task> task) {
     */
     unique_lock<mutex> lock(taskqueMutex);
 
-    // while (taskSize == taskCapacity){notFull.wait_for(lock, chrono::seconds(1));}
+    if(!enqueueTask(lock, task)) {
+        return Result(task, false);
+    }
 
     /*
-    * 提交任务需要等待队列不满
-    * 等待锁与条件，条件满足则从等待状态->阻塞状态，拿到锁则从阻塞状态->允许状态
-    * 超时返回
+    * Result在持有锁时构造，保证工作线程执行任务前Result已经绑定到Task
     */
-    if(!notFull.wait_for(lock, chrono::seconds(1), [&]()->bool { return taskCapacity > taskSize; })) {
-        cerr << "Time out." << "\n";
-        return Result(task, false);
+    return Result(task, true);
+}
+
+bool ThreadPool::execute(shared_ptr<Task> task) {
+    unique_lock<mutex> lock(taskqueMutex);
+    return enqueueTask(lock, task);
+}
+
+bool ThreadPool::execute(function<void()> func) {
+    return execute(make_shared<FuncTask>(move(func)));
+}
+
+bool ThreadPool::tryExecute(shared_ptr<Task> task) {
+    unique_lock<mutex> lock(taskqueMutex);
+    return enqueueTask(lock, task, false);
+}
+
+bool ThreadPool::tryExecute(function<void()> func) {
+    return tryExecute(make_shared<FuncTask>(move(func)));
+}
+
+/*
+* 一组同时执行的任务，所有成员都结束后完成task绑定的Result
+*/
+struct ThreadPool::Gang {
+    Gang(int n, function<void(int, SpinBarrier&)> fn)
+        :size(n)
+         ,body(move(fn))
+         ,barrier(n)
+         ,remaining(n)
+         ,task(make_shared<FuncTask>([]() {}))
+         ,acquiring(false)
+    {}
+
+    int size;
+    function<void(int, SpinBarrier&)> body;
+    SpinBarrier barrier;
+    atomic_int remaining;
+    shared_ptr<Task> task;
+
+    /*
+    * 登记了CPU预算时，放出之前先在锁外一次取得整组的槽位，成员各自在结束时归还一个
+    * 正在取槽位时为true，只在持有taskqueMutex时访问
+    */
+    bool acquiring;
+};
+
+Result ThreadPool::submitGang(int n, function<void(int, SpinBarrier&)> body) {
+    unique_lock<mutex> lock(taskqueMutex);
+    shared_ptr<Gang> gang = make_shared<Gang>(n, move(body));
+
+    /*
+    * 组的大小超过线程池能提供的线程数时永远凑不齐，直接拒绝
+    * cached模式下先把线程扩充到n个
+    */
+    int available = currentThreadSize - retireRequests;
+    if(checkRunning() && poolMode == PoolMode::MODE_CACHED && n > available && n <= threadCapacity) {
+        resizeThreads(n);
+        available = n;
+    }
+    if(n < 1 || !checkRunning() || n > available) {
+        cerr << "Gang size exceeds the number of threads, rejected." << "\n";
+        return Result(gang->task, false);
     }
 
     /*
-    * 放入任务
+    * 成员需要同时占用n个预算槽位，超过槽位数的组永远凑不齐
     */
-    taskque.emplace(task);
-    taskSize++;
+    if(cpuBudget != nullptr && n > cpuBudget->getSlots()) {
+        cerr << "Gang size exceeds the CPU budget, rejected." << "\n";
+        return Result(gang->task, false);
+    }
+
+    pendingGangs.emplace(gang);
 
     /*
-    * 通知队列不空
+    * 唤醒空闲线程为这一组预留
     */
     notEmpty.notify_all();
 
+    /*
+    * Result在持有锁时构造，保证最后一个成员完成前Result已经绑定到Task
+    */
+    return Result(gang->task, true);
+}
+
+void ThreadPool::admitGang() {
+    shared_ptr<Gang> gang = move(pendingGangs.front());
+    pendingGangs.pop();
+
+    for(int rank = 0; rank < gang->size; rank++) {
+        gangMembers.emplace(make_shared<FuncTask>([gang, rank]() {
+            gang->body(rank, gang->barrier);
+            if(gang->remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+                gang->task->exec();
+            }
+        }));
+    }
+    notEmpty.notify_all();
+}
+
+bool ThreadPool::enqueueTask(unique_lock<mutex>& lock, shared_ptr<Task> task, bool wait) {
+    // while (taskSize == taskCapacity){notFull.wait_for(lock, chrono::seconds(1));}
+
+    /*
+    * 溢写成功的任务由工作线程在队列有空位时读回，不需要等待
+    */
+    if(!spillTask(task)) {
+        /*
+        * 非阻塞提交不等待空位
+        */
+        if(!wait && taskCapacity <= static_cast<int>(taskSize)) {
+            return false;
+        }
+
+        /*
+        * 提交任务需要等待队列不满
+        * 等待锁与条件，条件满足则从等待状态->阻塞状态，拿到锁则从阻塞状态->允许状态
+        * 超时返回
+        */
+        if(!notFull.wait_for(lock, chrono::seconds(1), [&]()->bool { return taskCapacity > static_cast<int>(taskSize); })) {
+            cerr << "Time out." << "\n";
+            return false;
+        }
+
+        /*
+        * 放入任务
+        */
+        taskque.emplace(task);
+        taskSize++;
+
+        /*
+        * 通知队列不空
+        */
+        notEmpty.notify_all();
+    }
+
     /*
      * 每次放完任务判断一下当前线程是否过忙，过忙是添加新线程 
     */
     if(poolMode == PoolMode::MODE_CACHED
-        && taskSize > idleThreadSize
+        && static_cast<int>(taskSize) > idleThreadSize
         && currentThreadSize < threadCapacity) {
-            unique_ptr<Thread> thread_ptr = make_unique<Thread>(bind(&ThreadPool::threadFunc, this));
-            threads.emplace_back(move(thread_ptr));
+            addThread();
             cout << "new Thread" << endl;
         }
 
-    return Result(task, true);
+    return true;
 }
 
-void ThreadPool::start(int size = 4) {
-    initThreadSize = size; 
+bool ThreadPool::spillTask(const shared_ptr<Task>& task) {
+    if(spillFile == nullptr || (taskCapacity > static_cast<int>(taskSize) && spilledTasks.empty())) {
+        return false;
+    }
+    shared_ptr<SerializableTask> spillable = dynamic_pointer_cast<SerializableTask>(task);
+    if(spillable == nullptr) {
+        return false;
+    }
+
+    string payload;
+    spillable->serialize(payload);
+    if(!spillFile->append(payload)) {
+        /*
+        * 写入失败时恢复负载，按普通任务等待队列空位
+        */
+        spillable->deserialize(payload);
+        return false;
+    }
+    spilledTasks.emplace(move(spillable));
+    return true;
+}
 
-    currentThreadSize = size;
+void ThreadPool::pageInSpilled() {
+    if(spilledTasks.empty()) {
+        return;
+    }
+    string payload;
+    bool pagedIn = false;
+    while(!spilledTasks.empty() && taskCapacity > static_cast<int>(taskSize) && spillFile->pop(payload)) {
+        shared_ptr<SerializableTask> task = move(spilledTasks.front());
+        spilledTasks.pop();
+
+        /*
+        * 已取消的任务不会执行，不需要恢复负载
+        */
+        if(!task->isCancelled()) {
+            task->deserialize(payload);
+        }
+        taskque.emplace(move(task));
+        taskSize++;
+        pagedIn = true;
+    }
+    if(pagedIn) {
+        notEmpty.notify_all();
+    }
+}
+
+void ThreadPool::start(int size) {
+    unique_lock<mutex> lock(taskqueMutex);
+
+    /*
+    * 未指定线程数时优先使用启动前通过reconfigure/resize设置的coreThreads
+    */
+    if(size <= 0) {
+        size = initThreadSize > 0 ? static_cast<int>(initThreadSize) : availableCpus();
+    }
+    initThreadSize = size; 
+    threadCapacity = max(threadCapacity, size);
     /*
     * 标记启动
     */
     isRunning = true;
      
-    for(int i = 0; i < initThreadSize; i++) {
-        /*
-        * C++14 make_unique<Thread>创建独占智能指针
-        */
-        unique_ptr<Thread> thread_ptr = make_unique<Thread>(bind(&ThreadPool::threadFunc, this));
-
-        /*
-         * 左值代表的是对象本身，也意味着它有一个可以访问的内存地址，可以出现在赋值运算符的左边和右边
-         * 右值代表的是对象的值，或者一个即将结束生命周期的对象，右值只能出现在赋值运算符的右边
-         * 使用move函数可以将右值转换为左值，这样可以方便进行资源转移而不用复制资源
-         * 
-         * 复制操作：复制操作创建一个新对象，并将原对象的状态复制到新对象，这会涉及到资源的分配，以及数据的拷贝
-         * 移动操作：移动操作将原对象的状态转移到新对象，而不需要复制数据，原对象通常会被置空
-         * 移动操作性能比复制操作好，因为不涉及数据的拷贝
-         * 
-         * emplace_back和push_back都是往容器的末尾添加新元素，但emplace_back性能要更佳
-         * push_back接收已经构造好的对象，并将其复制（已经存在的对象）和移动（临时对象）到容器的末尾
-         * emplace_back可以接收参数直接在尾部构造一个新的对象，可以避免复制和拷贝
-         * 
-         * unique_ptr是独占智能指针，其对象只允许一个指向的指针，所以不允许复制，只允许移动
-         * move将左值转换为右值，这样可以通过移动操作进行所有权转移
-         */
-        threads.emplace_back(move(thread_ptr));
+    for(int i = 0; i < size; i++) {
+        addThread();
     }
-    
-    for(int i = 0; i < initThreadSize; i++) {
-        threads[i]->begin();
-        idleThreadSize++;
+}
+
+void ThreadPool::resize(int size) {
+    lock_guard<mutex> lock(taskqueMutex);
+    PoolConfig config = currentConfig();
+    config.coreThreads = size;
+    config.maxThreads = max(config.maxThreads, size);
+    applyConfig(config);
+}
+
+void ThreadPool::resizeThreads(int size) {
+    /*
+    * 先抵消尚未完成的缩容请求，再决定是创建线程还是请求线程退出
+    */
+    int target = currentThreadSize - retireRequests;
+    if(size > target) {
+        int cancelled = min(retireRequests, size - target);
+        retireRequests -= cancelled;
+        target += cancelled;
+        for(; target < size; target++) {
+            addThread();
+        }
+    } else if(size < target) {
+        retireRequests += target - size;
+        notEmpty.notify_all();
     }
 }
 
-void ThreadPool::threadFunc() {
+int ThreadPool::getThreadSize() {
+    lock_guard<mutex> lock(taskqueMutex);
+    return currentThreadSize;
+}
+
+void ThreadPool::addThread() {
+    /*
+    * C++14 make_unique<Thread>创建独占智能指针
+    * 线程函数通过占位符接收线程ID
+    */
+    unique_ptr<Thread> thread_ptr = make_unique<Thread>(bind(&ThreadPool::threadFunc, this, placeholders::_1));
+
+    /*
+     * 左值代表的是对象本身，也意味着它有一个可以访问的内存地址，可以出现在赋值运算符的左边和右边
+     * 右值代表的是对象的值，或者一个即将结束生命周期的对象，右值只能出现在赋值运算符的右边
+     * 使用move函数可以将右值转换为左值，这样可以方便进行资源转移而不用复制资源
+     * 
+     * 复制操作：复制操作创建一个新对象，并将原对象的状态复制到新对象，这会涉及到资源的分配，以及数据的拷贝
+     * 移动操作：移动操作将原对象的状态转移到新对象，而不需要复制数据，原对象通常会被置空
+     * 移动操作性能比复制操作好，因为不涉及数据的拷贝
+     * 
+     * emplace_back和push_back都是往容器的末尾添加新元素，但emplace_back性能要更佳
+     * push_back接收已经构造好的对象，并将其复制（已经存在的对象）和移动（临时对象）到容器的末尾
+     * emplace_back可以接收参数直接在尾部构造一个新的对象，可以避免复制和拷贝
+     * 
+     * unique_ptr是独占智能指针，其对象只允许一个指向的指针，所以不允许复制，只允许移动
+     * move将左值转换为右值，这样可以通过移动操作进行所有权转移
+     */
+    Thread* thread = thread_ptr.get();
+    threads.emplace(thread->getId(), move(thread_ptr));
+    currentThreadSize++;
+    idleThreadSize++;
+    thread->begin();
+}
+
+void ThreadPool::removeThread(int threadid) {
+    threads.erase(threadid);
+    currentThreadSize--;
+    idleThreadSize--;
+    exitCond.notify_all();
+}
+
+void ThreadPool::threadFunc(int threadid) {
     /*
      * 记录上次线程执行任务的时间（此处为初始化）
     */
     auto lastTime = chrono::high_resolution_clock().now();
 
+    /*
+    * 工作线程参与全局epoch域，任务中使用的无锁容器依赖它回收内存
+    */
+    EpochDomain& epoch = EpochDomain::global();
+
     for(;;) {
+        /*
+        * 上一个任务已经执行完，不再持有任何共享节点的指针，公布当前epoch
+        */
+        epoch.quiescent();
+
+        /*
+        * 队列为空时先在锁外自旋一小段时间，任务很快到来时不需要睡眠和唤醒
+        */
+        for(int i = spinBudget.load(memory_order_relaxed); i > 0 && taskSize == 0; i--) {
+            cpuRelax();
+        }
+
         shared_ptr<Task> task;
+
+        /*
+        * 成组任务的成员使用放出时为整组取得的槽位
+        */
+        bool gangMember = false;
+
+        /*
+        * 本轮开始为成组任务预留的时间，超过GANG_RESERVE_WAIT后可以执行一个排队的普通任务
+        */
+        chrono::steady_clock::time_point reservedSince;
+        bool runQueued = false;
+
         /*
         * 减轻锁重量，避免等待任务执行完毕再释放锁
         */
@@ -153,50 +537,126 @@ void ThreadPool::threadFunc() {
             */
             unique_lock<mutex> lock(taskqueMutex);
 
-            idleThreadSize--;
-
             /*
             * 等待条件变量
             * 被唤醒->获取锁->判断条件变量是否满足->继续执行
+            * 只有在队列为空时才考虑退出，线程池停止时先把剩余任务执行完
             */
-            if(poolMode == PoolMode::MODE_CACHED) {
+            while(task == nullptr) {
+                /*
+                * 成组任务的成员优先执行，保证同一组的成员同时开始
+                */
+                if(!gangMembers.empty()) {
+                    task = move(gangMembers.front());
+                    gangMembers.pop();
+                    gangMember = true;
+                    break;
+                }
+
                 /*
-                 * cached模式需要回收长期不执行任务的线程
+                * 有成组任务在等待时，空闲下来的线程不再取普通任务，而是为它预留；
+                * 预留的线程数达到组的大小时，由最后一个到达的线程一次性放出所有成员
                 */
-                while(taskSize > 0) {
-                    if(cv_status::timeout ==
-                        notEmpty.wait_for(lock, chrono::seconds(1))) {
-                            auto now = chrono::high_resolution_clock().now();
-                            auto dur = chrono::duration_cast<chrono::seconds>(now - lastTime);
-                            if(dur.count() >= TIME_OUT
-                                && currentThreadSize >= initThreadSize) {
-                                /*
-                                * 回收线程
-                                */
-                                
-                            }
+                if(!pendingGangs.empty() && !(runQueued && taskSize > 0)) {
+                    shared_ptr<Gang> gang = pendingGangs.front();
+                    if(!gang->acquiring && reservedThreads + 1 >= gang->size) {
+                        /*
+                        * 在锁外一次取得整组的槽位，期间本线程仍算作预留，后到的线程看到acquiring后继续预留
+                        * 成员逐个取槽位时，先开始的成员占着槽位等待后面的成员，槽位不足时会互相等死
+                        */
+                        if(cpuBudget != nullptr) {
+                            gang->acquiring = true;
+                            reservedThreads++;
+                            lock.unlock();
+                            epoch.offline();
+                            cpuBudget->acquireGang(budgetMember, gang->size);
+                            epoch.quiescent();
+                            lock.lock();
+                            reservedThreads--;
+                            gang->acquiring = false;
                         }
+                        admitGang();
+                        continue;
+                    }
+
+                    /*
+                    * 预留期间排队的普通任务没有线程执行，而正在执行的任务可能在Result::get中等待其中某一个，
+                    * 组的大小等于线程数时就永远凑不齐。预留超过GANG_RESERVE_WAIT后暂时离开，执行一个排队的任务再回来；
+                    * 按预留开始的时间计算，提交任务带来的唤醒不会推迟离开
+                    */
+                    if(reservedSince == chrono::steady_clock::time_point()) {
+                        reservedSince = chrono::steady_clock::now();
+                    }
+                    reservedThreads++;
+                    epoch.offline();
+                    notEmpty.wait_until(lock, reservedSince + GANG_RESERVE_WAIT);
+                    epoch.quiescent();
+                    reservedThreads--;
+                    runQueued = !gang->acquiring && chrono::steady_clock::now() >= reservedSince + GANG_RESERVE_WAIT;
+                    continue;
                 }
-            } else {
-                notEmpty.wait(lock, [&]()->bool{ return taskSize > 0; });
-            }
 
-            /*
-            * 条件满足消费任务
-            */
-            task = taskque.front();
-            taskque.pop();
-            taskSize--;
+                if(taskSize > 0) {
+                    /*
+                    * 条件满足消费任务
+                    */
+                    task = taskque.front();
+                    taskque.pop();
+                    taskSize--;
+
+                    /*
+                    * 腾出的空位优先留给溢写的任务，保持先进先出
+                    */
+                    pageInSpilled();
+
+                    /*
+                    * 通知生产者队列不满
+                    */
+                    notFull.notify_all();
+                    break;
+                }
 
-            // 可能是多余的
-            // if(taskSize > 0) {
-            //     notEmpty.notify_all();
-            // }
+                /*
+                * 线程池停止或者正在缩容，空闲线程退出
+                */
+                if(!checkRunning() || retireRequests > 0) {
+                    if(retireRequests > 0) {
+                        retireRequests--;
+                    }
+                    epoch.offline();
+                    removeThread(threadid);
+                    return;
+                }
 
-            /*
-            * 通知生产者队列不满
-            */
-            notFull.notify_all();
+                /*
+                * 睡眠期间退出临界区，空闲线程不能阻止epoch前进
+                */
+                epoch.offline();
+                if(poolMode == PoolMode::MODE_CACHED) {
+                    /*
+                     * cached模式需要回收长期不执行任务的线程
+                    */
+                    cv_status status = notEmpty.wait_for(lock, min<chrono::seconds>(chrono::seconds(1), keepAlive));
+                    epoch.quiescent();
+                    if(cv_status::timeout == status) {
+                        auto now = chrono::high_resolution_clock().now();
+                        if(now - lastTime >= keepAlive
+                            && currentThreadSize - retireRequests > static_cast<int>(initThreadSize)) {
+                            /*
+                            * 回收线程
+                            */
+                            epoch.offline();
+                            removeThread(threadid);
+                            return;
+                        }
+                    }
+                } else {
+                    notEmpty.wait(lock);
+                    epoch.quiescent();
+                }
+            }
+
+            idleThreadSize--;
 
         } // 释放锁
 
@@ -204,7 +664,40 @@ void ThreadPool::threadFunc() {
         * 执行任务
         */
         if(task != nullptr) {
+            /*
+            * 取得任务后才占用预算槽位，等待槽位时线程处于睡眠状态，不参与调度
+            */
+            if(cpuBudget != nullptr && !gangMember) {
+                epoch.offline();
+                cpuBudget->acquire(budgetMember);
+                epoch.quiescent();
+            }
+            int64_t slice = timeSliceUs.load(memory_order_relaxed);
+            if(slice > 0 && task->resumable) {
+                task->sliceDeadline = chrono::steady_clock::now() + chrono::microseconds(slice);
+            }
+            /*
+            * 执行期间保持在临界区中，任务里的EpochGuard退出时不会把工作线程标记为不活跃
+            */
+            epoch.enterTask();
             task->exec();
+            epoch.exitTask();
+            task->sliceDeadline = chrono::steady_clock::time_point::max();
+            if(cpuBudget != nullptr) {
+                cpuBudget->release(budgetMember);
+            }
+
+            /*
+            * 时间片用完让出的任务放回队尾，排在它后面的任务先执行
+            * 不等待队列空位，否则所有工作线程都可能阻塞在这里；最多超出阈值工作线程数个任务
+            */
+            if(task->yielded) {
+                task->yielded = false;
+                lock_guard<mutex> lock(taskqueMutex);
+                taskque.emplace(move(task));
+                taskSize++;
+                notEmpty.notify_one();
+            }
         }
 
         idleThreadSize++;
@@ -218,7 +711,7 @@ bool ThreadPool::checkRunning() const {
     return isRunning;
 }
 
-int Thread::generateID = 0;
+atomic_int Thread::generateID(0);
 
 Thread::Thread(ThreadFunc fc)
     :func(fc), threadID(generateID++)
@@ -251,7 +744,7 @@ void Thread::begin() {
     /*
     * 创建线程对象
     */
-    thread t(func);
+    thread t(func, threadID);
     
     /*
     * 将线程对象和线程分离
@@ -273,6 +766,10 @@ Any Result::get() {
         return "";
     }
 
+    /*
+    * 工作线程等待其他任务时临时归还CPU预算槽位
+    */
+    CpuBudget::BlockingRegion region;
     sem.wait();
     return move(anyres);
 }
@@ -282,15 +779,78 @@ void Result::setAny(Any any) {
     sem.post();
 }
 
+/*
+* 记录当前线程正在执行的任务，任务中可能同步执行其他任务，所以退出时恢复上一个
+*/
+static thread_local Task* currentTask = nullptr;
+
 Task::Task() 
     :result(nullptr)
+     ,cancelled(false)
+     ,resumable(false)
+     ,sliceDeadline(chrono::steady_clock::time_point::max())
+     ,yielded(false)
 {}
 
+ResumableTask::ResumableTask() {
+    resumable = true;
+}
+
 void Task::exec() {
-    if(result == nullptr) { return; }
-    result->setAny(run());
+    /*
+    * 已取消的任务不执行，但仍然通知Result，避免get()永远阻塞
+    */
+    Any any;
+    if(!isCancelled()) {
+        Task* prev = currentTask;
+        currentTask = this;
+        any = run();
+        currentTask = prev;
+    }
+
+    /*
+    * 让出时间片的任务还没有完成，返回值被忽略
+    */
+    if(yielded) {
+        return;
+    }
+
+    /*
+    * 通过execute提交的任务没有绑定Result，执行后直接丢弃返回值
+    */
+    if(result != nullptr) {
+        result->setAny(move(any));
+    }
 }
 
 void Task::setResult(Result* res) {
     result = res;
 }
+
+void Task::cancel() {
+    cancelled.store(true, memory_order_release);
+}
+
+bool Task::isCancelled() const {
+    return cancelled.load(memory_order_acquire);
+}
+
+Task* this_task::current() {
+    return currentTask;
+}
+
+bool this_task::is_cancelled() {
+    return currentTask != nullptr && currentTask->isCancelled();
+}
+
+bool this_task::yield_if_expired() {
+    Task* task = currentTask;
+    if(task == nullptr || task->sliceDeadline == chrono::steady_clock::time_point::max()) {
+        return false;
+    }
+    if(chrono::steady_clock::now() < task->sliceDeadline) {
+        return false;
+    }
+    task->yielded = true;
+    return true;
+}
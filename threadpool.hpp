@@ -2,12 +2,17 @@
 #define THREADPOOL_H
 
 #include <vector>
+#include <unordered_map>
 #include <queue>
 #include <memory>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <chrono>
+#include <string>
+
+#include "primitives.hpp"
 
 using namespace std;
 
@@ -63,28 +68,6 @@ private:
     unique_ptr<Base> base_ptr;
 };
 
-class Semaphore {
-public: 
-    Semaphore(int resource = 0) : resource_(resource) {}
-    ~Semaphore() = default;
-
-    void wait() {
-        unique_lock<mutex> lock(semaphore_mutex);
-        cv.wait(lock, [&]()->bool { return resource_ > 0; });
-        resource_--;
-    }
-
-    void post() {
-        unique_lock<mutex> lock(semaphore_mutex);
-        resource_++;
-        cv.notify_all();
-    }
-private:
-    int resource_;
-    mutex semaphore_mutex;
-    condition_variable cv;
-};
-
 /*
 template<typename T>
 class MyAny {
@@ -109,8 +92,9 @@ public:
     * 可以像函数一样使用可调用对象
     * 线程执行的任务由线程池分配，所以线程需要接收一个可调用线程对象
     * 该对象来自线程池的任务对象
+    * 参数是线程ID，线程退出时用它从线程池中移除自己
     */
-    using ThreadFunc = function<void()>;
+    using ThreadFunc = function<void(int)>;
 
     Thread(ThreadFunc func);
 
@@ -123,7 +107,7 @@ public:
     int getId() const;
 private:
     ThreadFunc func;
-    static int fatherThreadId;
+    static atomic_int generateID;
     int threadID;
 };
 
@@ -132,6 +116,10 @@ private:
 */
 class Task;
 
+namespace this_task {
+    bool yield_if_expired();
+}
+
 class Result {
 public:
     Result(shared_ptr<Task> task, bool isValid = true);
@@ -164,8 +152,149 @@ public:
     virtual Any run() = 0;
     void setResult(Result* res);
 
+    /*
+    * 协作式取消：尚未执行的任务不再执行，Result得到空值
+    * 正在执行的任务需要在run中调用this_task::is_cancelled()主动退出
+    */
+    void cancel();
+    bool isCancelled() const;
+
 private:
+    /*
+    * 时间片由执行任务的线程池设置，只有线程池的工作线程执行ResumableTask时才能让出
+    */
+    friend class ThreadPool;
+    friend class ResumableTask;
+    friend bool this_task::yield_if_expired();
+
     Result* result;
+    atomic_bool cancelled;
+
+    /*
+    * 任务能否从保存的进度继续执行，只有ResumableTask为true
+    */
+    bool resumable;
+
+    /*
+    * 本次执行的时间片截止时间，time_point::max()表示不能让出
+    */
+    chrono::steady_clock::time_point sliceDeadline;
+
+    /*
+    * run因为时间片用完而提前返回，exec不通知Result，由线程池把任务重新放回队尾
+    */
+    bool yielded;
+};
+
+/*
+* 在Task::run内部访问当前正在执行的任务
+*/
+namespace this_task {
+    /*
+    * 当前线程正在执行的任务，不在任务中时返回nullptr
+    */
+    Task* current();
+
+    /*
+    * 当前任务是否已经被取消
+    */
+    bool is_cancelled();
+
+    /*
+    * 协作式时间片：线程池设置了时间片且当前ResumableTask已经用完时返回true，
+    * 任务应当保存进度并立即从run返回（返回值被忽略），线程池把它重新放到队尾，
+    * 下次被取出时再次调用run从保存的进度继续；Result在任务真正完成时才得到结果。
+    * 没有设置时间片、当前任务不是ResumableTask（包括FuncTask和库内部包装的任务），
+    * 或者任务不是由ThreadPool的工作线程执行时总是返回false
+    */
+    bool yield_if_expired();
+}
+
+/*
+* 可以被时间片打断的任务，继承它表示run能够保存进度并在下次调用时继续
+* 普通Task的run每次都从头执行，让出后重新执行会重复副作用，所以不会被让出
+*/
+class ResumableTask : public Task {
+public:
+    ResumableTask();
+};
+
+/*
+* 将可调用对象包装成Task，供不需要返回值的场景（如线程池之上的各类组件）投递闭包
+*/
+class FuncTask : public Task {
+public:
+    FuncTask(function<void()> func) : func_(move(func)) {}
+
+    Any run() {
+        func_();
+        return Any();
+    }
+private:
+    function<void()> func_;
+};
+
+/*
+* 可以溢写到磁盘的任务
+* 线程池开启溢写且队列已满时，负载通过serialize写入溢写文件，任务对象作为占位留在内存中，
+* Result和cancel仍然绑定在它上面；轮到它进入队列时先调用deserialize恢复负载。
+* 两个函数都在持有线程池锁时调用，应当只做序列化，不要提交任务。
+*/
+class SerializableTask : public Task {
+public:
+    /*
+    * 把负载写入out，之后可以释放负载占用的内存
+    */
+    virtual void serialize(string& out) = 0;
+    virtual void deserialize(const string& in) = 0;
+};
+
+class SpillFile;
+class CpuBudget;
+struct BudgetMember;
+
+const int TASK_MAX_THREADPOOL = 1024;
+/*
+ * cached模式的线程上限默认为可用CPU数的倍数
+ */
+const int THREAD_PER_CPU_THREADPOOL = 2;
+const int KEEP_ALIVE_THREADPOOL = 60;
+
+/*
+* 线程池的运行参数，可以在运行时通过reconfigure整体修改
+*/
+struct PoolConfig {
+    /*
+    * 常驻线程数，fixed模式下就是线程总数；启动前为0表示由start决定
+    */
+    int coreThreads = 0;
+
+    /*
+    * cached模式下的线程上限，0表示可用CPU数的THREAD_PER_CPU_THREADPOOL倍
+    */
+    int maxThreads = 0;
+
+    /*
+    * 任务队列阈值
+    */
+    int taskCapacity = TASK_MAX_THREADPOOL;
+
+    /*
+    * cached模式下超出coreThreads的线程空闲多久后回收
+    */
+    chrono::seconds keepAlive = chrono::seconds(KEEP_ALIVE_THREADPOOL);
+
+    /*
+    * 队列为空时工作线程睡眠前的自旋次数，0表示直接睡眠
+    */
+    int spinCount = 0;
+
+    /*
+    * ResumableTask的时间片，用完后this_task::yield_if_expired()返回true，0表示不分时间片
+    */
+    chrono::microseconds timeSlice = chrono::microseconds(0);
+
+    PoolMode mode = PoolMode::MODE_FIXED;
 };
 
 /*
@@ -186,7 +315,7 @@ public:
     ThreadPool();
 
     /*
-     * 设置线程池模式
+     * 设置线程池模式，运行中也可以切换
      */
     void setMode(PoolMode mode);
 
@@ -200,18 +329,84 @@ public:
     */
     void setThreadCapacity(int thread_capacity); 
 
+    /*
+     * 在持有队列锁时整体替换运行参数，不需要停止线程池，也不会丢弃队列中的任务
+     * 常驻线程增加时立即创建线程，减少时多出的线程空闲后退出；队列阈值增大时唤醒等待的提交者
+     * 参数不合法（线程数小于1、maxThreads小于coreThreads等）时不做修改并返回false
+     */
+    bool reconfigure(const PoolConfig& config);
+
+    /*
+     * 当前的运行参数
+     */
+    PoolConfig getConfig();
+
+    /*
+     * 设置ResumableTask的时间片，0表示不分时间片；其他任务不受影响
+     */
+    void setTimeSlice(chrono::microseconds slice);
+
+    /*
+     * 开启溢写：队列已满时SerializableTask的负载写入path处的内存映射文件而不是阻塞提交者，
+     * 队列有空位时按先进先出顺序读回。一旦有任务溢写，后续的可溢写任务也进入溢写文件，保证顺序
+     * 文件创建失败返回false
+     */
+    bool setOverflowSpill(const string& path);
+
+    /*
+     * 登记到进程级CPU预算，工作线程执行每个任务前先从预算取得槽位，需要在start之前调用
+     * makeThreadPool创建的线程池自动登记到全局预算
+     */
+    void setCpuBudget(CpuBudget& budget);
+
     /*
      * 提交任务
      */
     Result submitTask(shared_ptr<Task> task);
 
     /*
-     * 启动线程池
+     * 提交不需要返回值的任务，不创建Result
+     * 队列已满且等待超时返回false，任务不会被执行，由调用者决定如何处理（如在当前线程执行）
+     */
+    bool execute(shared_ptr<Task> task);
+    bool execute(function<void()> func);
+
+    /*
+     * 非阻塞的execute：队列已满且不能溢写时立即返回false，不等待空位，也不输出超时日志
+     * 适合提交失败时可以在当前线程执行的场景，如工作线程或定时器线程中派生的任务
+     */
+    bool tryExecute(shared_ptr<Task> task);
+    bool tryExecute(function<void()> func);
+
+    /*
+     * 成组调度：n个成员body(rank, barrier)在n个工作线程上同时开始，rank为0到n-1，
+     * 成员之间可以用barrier同步；所有成员结束后Result::get返回（空值）
+     * 有成组任务等待时，空闲下来的线程为它预留而不再取普通任务，凑齐n个后一起放出
+     * 登记了CPU预算时，放出前一次取得n个槽位，成员不再各自取槽位，也不会被时间片让出
+     * 预留的线程等待超过一小段时间后会暂时执行一个排队的普通任务，正在执行的任务等待排队任务时不会卡住成组任务
+     * n超过线程池的线程数或预算的槽位数时返回无效的Result；成员中不要等待其他提交到同一线程池的任务
+     */
+    Result submitGang(int n, function<void(int rank, SpinBarrier& barrier)> body);
+
+    /*
+     * 启动线程池，size为0时使用availableCpus()，即CPU亲和性和cgroup配额允许的CPU数
+     */
+    void start(int size = 0);
+
+    /*
+     * 调整常驻线程数，可以在运行时调用
+     * 扩容立即创建线程；缩容时多出的线程在执行完手上的任务、空闲后退出
+     */
+    void resize(int size);
+
+    /*
+     * 当前存在的线程数
      */
-    void start(int size);
+    int getThreadSize();
 
     /*
      * 析构函数
+     * 停止接收任务，等待队列中的任务执行完毕，所有工作线程退出后返回
      */
     ~ThreadPool();
     
@@ -234,7 +429,50 @@ private:
     /*
      * 线程函数放在线程中可以方便访问线程池对象的私有成员变量
      */
-    void threadFunc();
+    void threadFunc(int threadid);
+
+    /*
+     * 创建并启动一个工作线程，调用前需持有taskqueMutex
+     */
+    void addThread();
+
+    /*
+     * 工作线程退出前从线程池移除自己，调用前需持有taskqueMutex
+     */
+    void removeThread(int threadid);
+
+    /*
+     * 应用新的运行参数，调用前需持有taskqueMutex
+     */
+    bool applyConfig(const PoolConfig& config);
+    PoolConfig currentConfig() const;
+
+    /*
+     * 把线程数调整为size，调用前需持有taskqueMutex
+     */
+    void resizeThreads(int size);
+
+    /*
+     * 放出等待中的第一个成组任务，调用前需持有taskqueMutex
+     */
+    struct Gang;
+    void admitGang();
+
+    /*
+     * 等待队列不满并放入任务，wait为false时队列已满立即返回false，调用前需持有taskqueMutex
+     */
+    bool enqueueTask(unique_lock<mutex>& lock, shared_ptr<Task> task, bool wait = true);
+
+    /*
+     * 队列已满或已有任务溢写时把可溢写任务写入溢写文件，任务不可溢写或写入失败返回false
+     * 调用前需持有taskqueMutex
+     */
+    bool spillTask(const shared_ptr<Task>& task);
+
+    /*
+     * 队列有空位时按顺序读回溢写的任务，调用前需持有taskqueMutex
+     */
+    void pageInSpilled();
 
     /*
     * 检查运行状态
@@ -257,7 +495,7 @@ private:
      * shared_ptr是一种共享的所有权智能指针，可以有多个指向对象的指针，
      * 并跟踪记录指针，当所有指向对象的指针被销毁时，销毁对象。
      */
-    vector<unique_ptr<Thread>> threads;
+    unordered_map<int, unique_ptr<Thread>> threads;
 
     /*
      * size_t 是一个无符号整数类型，它保证了代码在不同平台上的可移植性。
@@ -273,6 +511,18 @@ private:
      * 记录当前存在的线程 
     */
     int currentThreadSize;
+
+    /*
+     * 缩容时还需要退出的线程数，空闲线程看到它大于0时退出
+     */
+    int retireRequests;
+
+    /*
+     * 等待中的成组任务、已经放出等待执行的成员，以及正在为成组任务预留的睡眠线程数
+     */
+    queue<shared_ptr<Gang>> pendingGangs;
+    queue<shared_ptr<Task>> gangMembers;
+    int reservedThreads;
     /*
      * CPP 对象的多态性只能通过指针或引用实现，所以想在队列中存储Task的派生对象，并通过基类指针访问它们，就必须使用指针和引用。
      * 同时在队列中存储Task对象需要消耗大量的内存，直接存储指针则可以节省内存。
@@ -305,11 +555,43 @@ private:
     condition_variable notFull;
     condition_variable notEmpty;
 
+    /*
+     * 工作线程退出时通知，析构函数等待所有线程退出
+     */
+    condition_variable exitCond;
+
+    /*
+     * 溢写文件和已溢写任务的占位，两者顺序一致
+     */
+    unique_ptr<SpillFile> spillFile;
+    queue<shared_ptr<SerializableTask>> spilledTasks;
+
+    /*
+     * 所属的CPU预算，未登记时为空
+     */
+    CpuBudget* cpuBudget;
+    BudgetMember* budgetMember;
+
     /*
      * 记录PoolMode
      */
     PoolMode poolMode;
 
+    /*
+     * cached模式下空闲线程的存活时间
+     */
+    chrono::seconds keepAlive;
+
+    /*
+     * 工作线程睡眠前的自旋次数，在锁外读取
+     */
+    atomic_int spinBudget;
+
+    /*
+     * 任务时间片（微秒），在锁外读取
+     */
+    atomic<int64_t> timeSliceUs;
+
     /*
     * 启动标识
     */